@@ -1,5 +1,8 @@
 #include "args.h"
+#include <stdint.h>
 #include <stdlib.h>
+#include "pipeline.h"
+#include "tempfile.h"
 
 #ifndef _WIN32
     #include <ctype.h>
@@ -26,28 +29,65 @@
     }
 #endif // _WIN32
 
-static void parse_arg_file(struct Arguments* args, const arg_char* arg) {
-    if(args->filenames == NULL) {
-        args->filenames = malloc(sizeof(arg_char*));
-        args->filenames_capacity = 1;
-        args->num_filenames = 0;
+/* Appends 'arg' to a growable array of arguments. */
+static void append_arg(const arg_char*** array, size_t* num,
+                       size_t* capacity, const arg_char* arg) {
+    if(*array == NULL) {
+        *array = malloc(sizeof(arg_char*));
+        *capacity = 1;
+        *num = 0;
     }
-    if(++(args->num_filenames) > args->filenames_capacity) {
+    if(++(*num) > *capacity) {
         // Grow array by factor of 1.5 if not enough capacity
-        size_t new_capacity = args->filenames_capacity + (
-            1 + ((args->filenames_capacity - 1) / 2)
-        );
-        args->filenames = realloc(
-            args->filenames, new_capacity * sizeof(arg_char*)
-        );
+        size_t new_capacity = *capacity + (1 + ((*capacity - 1) / 2));
+        *array = realloc(*array, new_capacity * sizeof(arg_char*));
         // Clear newly allocated memory
         memset(
-            args->filenames + args->filenames_capacity, 0,
-            (new_capacity - args->filenames_capacity) * sizeof(arg_char*)
+            *array + *capacity, 0,
+            (new_capacity - *capacity) * sizeof(arg_char*)
+        );
+        *capacity = new_capacity;
+    }
+    (*array)[*num - 1] = arg;
+}
+
+static void parse_arg_file(struct Arguments* args, const arg_char* arg) {
+    append_arg(
+        &args->filenames, &args->num_filenames, &args->filenames_capacity,
+        arg
+    );
+}
+
+static void print_missing_argument(const arg_char* prog_name,
+                                   const arg_char* arg_name) {
+    if(!arg_strncmp(arg_name, arg_s("--"), 2)) {
+        arg_printerr(
+            arg_f arg_s(": option '") arg_f
+            arg_s("' requires an argument"), prog_name, arg_name
+        );
+    } else {
+        arg_printerr(
+            arg_f arg_s(": option requires an argument -- '") arg_f
+            arg_s("'"), prog_name, arg_name
+        );
+    }
+}
+
+static void print_invalid_argument(const arg_char* prog_name,
+                                   const arg_char* arg_name,
+                                   const arg_char* arg) {
+    if(!arg_strncmp(arg_name, arg_s("--"), 2)) {
+        arg_printerr(
+            arg_f arg_s(": option '") arg_f
+            arg_s("' given invalid argument '") arg_f arg_s("'"),
+            prog_name, arg_name, arg
+        );
+    } else {
+        arg_printerr(
+            arg_f arg_s(": option given invalid argument '") arg_f
+            arg_s("' -- '") arg_f arg_s("'"), prog_name, arg, arg_name
         );
-        args->filenames_capacity = new_capacity;
     }
-    args->filenames[args->num_filenames - 1] = arg;
 }
 
 static void parse_arg_option_type(struct Arguments* args,
@@ -57,17 +97,7 @@ static void parse_arg_option_type(struct Arguments* args,
     if(arg == NULL) {
         // No argument given for option
         args->valid = false;
-        if(!arg_strncmp(arg_name, arg_s("--"), 2)) {
-            arg_printerr(
-                arg_f arg_s(": option '") arg_f
-                arg_s("' requires an argument"), prog_name, arg_name
-            );
-        } else {
-            arg_printerr(
-                arg_f arg_s(": option requires an argument -- '") arg_f
-                arg_s("'"), prog_name, arg_name
-            );
-        }
+        print_missing_argument(prog_name, arg_name);
         return;
     }
 
@@ -85,19 +115,219 @@ static void parse_arg_option_type(struct Arguments* args,
     } else {
         // Invalid argument
         args->valid = false;
-        if(!arg_strncmp(arg_name, arg_s("--"), 2)) {
-            arg_printerr(
-                arg_f arg_s(": option '") arg_f
-                arg_s("' given invalid argument '") arg_f arg_s("'"),
-                prog_name, arg_name, arg
-            );
-        } else {
-            arg_printerr(
-                arg_f arg_s(": option given invalid argument '") arg_f
-                arg_s("' -- '") arg_f arg_s("'"), prog_name, arg, arg_name
-            );
+        print_invalid_argument(prog_name, arg_name, arg);
+    }
+}
+
+/* Parses a positive decimal number from 'arg' into 'value'. Returns false if
+'arg' isn't a positive decimal number. */
+static bool parse_count(const arg_char* arg, size_t* value) {
+    size_t result = 0;
+    if(*arg == arg_s('\0')) {
+        return false;
+    }
+    for(; *arg != arg_s('\0'); ++arg) {
+        if(*arg < arg_s('0') || *arg > arg_s('9') ||
+                result > (SIZE_MAX - 9) / 10) {
+            return false;
+        }
+        result = result * 10 + (size_t)(*arg - arg_s('0'));
+    }
+    if(result == 0) {
+        return false;
+    }
+    *value = result;
+    return true;
+}
+
+static void parse_arg_option_jobs(struct Arguments* args,
+                                  const arg_char* prog_name,
+                                  const arg_char* arg_name,
+                                  const arg_char* arg) {
+    if(arg == NULL) {
+        args->valid = false;
+        print_missing_argument(prog_name, arg_name);
+    } else if(!parse_count(arg, &args->jobs)) {
+        args->valid = false;
+        print_invalid_argument(prog_name, arg_name, arg);
+    }
+}
+
+/* Parses a size in bytes from 'arg' into 'value', which may end with a 'K',
+'M' or 'G' suffix for KiB, MiB or GiB. Returns false if 'arg' isn't a positive
+size. */
+static bool parse_size(const arg_char* arg, size_t* value) {
+    size_t len = arg_strlen(arg);
+    unsigned shift = 0;
+    if(len > 1) {
+        switch(arg[len - 1]) {
+            case arg_s('K'):
+            case arg_s('k'):
+                shift = 10;
+                break;
+            case arg_s('M'):
+            case arg_s('m'):
+                shift = 20;
+                break;
+            case arg_s('G'):
+            case arg_s('g'):
+                shift = 30;
+                break;
         }
     }
+    // Parse a copy of the digits before any suffix
+    arg_char digits[32];
+    if(shift) {
+        --len;
+    }
+    if(len >= sizeof(digits) / sizeof(arg_char)) {
+        return false;
+    }
+    memcpy(digits, arg, len * sizeof(arg_char));
+    digits[len] = arg_s('\0');
+    size_t result;
+    if(!parse_count(digits, &result) || result > (SIZE_MAX >> shift)) {
+        return false;
+    }
+    *value = result << shift;
+    return true;
+}
+
+/* Parses an option of the form '--name=SIZE' into 'value' */
+static void parse_arg_option_size(struct Arguments* args,
+                                  const arg_char* prog_name,
+                                  const arg_char* arg_name,
+                                  const arg_char* arg, size_t* value) {
+    if(arg == NULL) {
+        args->valid = false;
+        print_missing_argument(prog_name, arg_name);
+    } else if(!parse_size(arg, value)) {
+        args->valid = false;
+        print_invalid_argument(prog_name, arg_name, arg);
+    }
+}
+
+/* Parses an option of the form '--name=N' into 'value' */
+static void parse_arg_option_count(struct Arguments* args,
+                                   const arg_char* prog_name,
+                                   const arg_char* arg_name,
+                                   const arg_char* arg, size_t* value) {
+    if(arg == NULL) {
+        args->valid = false;
+        print_missing_argument(prog_name, arg_name);
+    } else if(!parse_count(arg, value)) {
+        args->valid = false;
+        print_invalid_argument(prog_name, arg_name, arg);
+    }
+}
+
+static void parse_arg_option_recursive(struct Arguments* args,
+                                       const arg_char* prog_name) {
+#ifdef _WIN32
+    arg_printerr(
+        arg_f arg_s(": recursive processing is currently not supported on ")
+        arg_s("Windows"), prog_name
+    );
+    args->valid = false;
+#else
+    (void)prog_name;
+    args->recursive = true;
+#endif // _WIN32
+}
+
+static void parse_arg_option_atomic(struct Arguments* args,
+                                    const arg_char* prog_name) {
+#ifdef __linux__
+    (void)prog_name;
+    args->atomic = true;
+#else
+    arg_printerr(
+        arg_f arg_s(": atomic replacement is currently only supported on ")
+        arg_s("Linux"), prog_name
+    );
+    args->valid = false;
+#endif // __linux__
+}
+
+static void parse_arg_option_cache(struct Arguments* args,
+                                   const arg_char* prog_name,
+                                   const arg_char* arg) {
+#ifdef _WIN32
+    (void)arg;
+    arg_printerr(
+        arg_f arg_s(": caching is currently not supported on Windows"),
+        prog_name
+    );
+    args->valid = false;
+#else
+    if(arg == NULL || arg[0] == arg_s('\0')) {
+        args->valid = false;
+        print_missing_argument(prog_name, arg_s("--cache"));
+    } else {
+        args->cache = arg;
+    }
+#endif // _WIN32
+}
+
+static void parse_arg_option_stats(struct Arguments* args,
+                                   const arg_char* prog_name,
+                                   const arg_char* arg) {
+    if(arg == NULL) {
+        args->stats = STATS_TEXT;
+    } else if(!arg_stricmp(arg, arg_s("json"))) {
+        args->stats = STATS_JSON;
+    } else {
+        args->valid = false;
+        print_invalid_argument(prog_name, arg_s("--stats"), arg);
+    }
+}
+
+static void parse_arg_option_binary(struct Arguments* args,
+                                    const arg_char* prog_name,
+                                    const arg_char* arg) {
+    if(arg == NULL) {
+        args->valid = false;
+        print_missing_argument(prog_name, arg_s("--binary"));
+    } else if(!arg_stricmp(arg, arg_s("skip"))) {
+        args->binary = BINARY_SKIP;
+    } else if(!arg_stricmp(arg, arg_s("report"))) {
+        args->binary = BINARY_REPORT;
+    } else if(!arg_stricmp(arg, arg_s("process"))) {
+        args->binary = BINARY_PROCESS;
+    } else {
+        args->valid = false;
+        print_invalid_argument(prog_name, arg_s("--binary"), arg);
+    }
+}
+
+/* Parses an option of the form '--name=FILE' naming a list of files to
+process, whose names end with a NUL character if 'nul' is true, or else a
+newline. */
+static void parse_arg_option_files_from(struct Arguments* args,
+                                        const arg_char* prog_name,
+                                        const arg_char* arg_name,
+                                        const arg_char* arg, bool nul) {
+    if(arg == NULL || arg[0] == arg_s('\0')) {
+        args->valid = false;
+        print_missing_argument(prog_name, arg_name);
+    } else {
+        args->files_from = arg;
+        args->files_from_nul = nul;
+    }
+}
+
+/* Parses an option of the form '--name=GLOB', appending GLOB to 'array'. */
+static void parse_arg_option_glob(struct Arguments* args,
+                                  const arg_char* prog_name,
+                                  const arg_char* arg_name,
+                                  const arg_char* arg, const arg_char*** array,
+                                  size_t* num, size_t* capacity) {
+    if(arg == NULL) {
+        args->valid = false;
+        print_missing_argument(prog_name, arg_name);
+    } else {
+        append_arg(array, num, capacity, arg);
+    }
 }
 
 struct Arguments parse_args(int argc, arg_char** argv) {
@@ -110,6 +340,27 @@ struct Arguments parse_args(int argc, arg_char** argv) {
         .trailing_newline = true,
         .strip_whitespace = true,
         .verbose = false,
+        .check = false,
+        .to_stdout = false,
+        .atomic = false,
+        .stats = STATS_NONE,
+        .binary = BINARY_SKIP,
+        .cache = NULL,
+        .files_from = NULL,
+        .files_from_nul = false,
+        .jobs = 0,
+        .buffer_size = FileBufferLen,
+        .pipeline_depth = PipelineDepth,
+        .io_uring = true,
+        .recursive = false,
+        .gitignore = true,
+        .gitattributes = true,
+        .num_includes = 0,
+        .includes_capacity = 0,
+        .includes = NULL,
+        .num_excludes = 0,
+        .excludes_capacity = 0,
+        .excludes = NULL,
         .num_filenames = 0,
         .filenames_capacity = 0,
         .filenames = NULL
@@ -144,12 +395,127 @@ struct Arguments parse_args(int argc, arg_char** argv) {
                 if(!args.valid) {
                     break;
                 }
+            } else if(!arg_strncmp(argv[i], arg_s("--jobs"), 6) &&
+                    (arg_len == 6 || argv[i][6] == arg_s('='))) {
+                if(arg_len == 6) {
+                    parse_arg_option_jobs(
+                        &args, argv[0], arg_s("--jobs"), NULL
+                    );
+                } else {
+                    parse_arg_option_jobs(
+                        &args, argv[0], arg_s("--jobs"), argv[i] + 7
+                    );
+                }
+                if(!args.valid) {
+                    break;
+                }
+            } else if(!arg_strcmp(argv[i], arg_s("--recursive"))) {
+                parse_arg_option_recursive(&args, argv[0]);
+                if(!args.valid) {
+                    break;
+                }
+            } else if(!arg_strncmp(argv[i], arg_s("--include"), 9) &&
+                    (arg_len == 9 || argv[i][9] == arg_s('='))) {
+                parse_arg_option_glob(
+                    &args, argv[0], arg_s("--include"),
+                    arg_len == 9 ? NULL : argv[i] + 10, &args.includes,
+                    &args.num_includes, &args.includes_capacity
+                );
+                if(!args.valid) {
+                    break;
+                }
+            } else if(!arg_strncmp(argv[i], arg_s("--exclude"), 9) &&
+                    (arg_len == 9 || argv[i][9] == arg_s('='))) {
+                parse_arg_option_glob(
+                    &args, argv[0], arg_s("--exclude"),
+                    arg_len == 9 ? NULL : argv[i] + 10, &args.excludes,
+                    &args.num_excludes, &args.excludes_capacity
+                );
+                if(!args.valid) {
+                    break;
+                }
+            } else if(!arg_strncmp(argv[i], arg_s("--cache"), 7) &&
+                    (arg_len == 7 || argv[i][7] == arg_s('='))) {
+                parse_arg_option_cache(
+                    &args, argv[0], arg_len == 7 ? NULL : argv[i] + 8
+                );
+                if(!args.valid) {
+                    break;
+                }
+            } else if(!arg_strncmp(argv[i], arg_s("--files-from"), 12) &&
+                    (arg_len == 12 || argv[i][12] == arg_s('='))) {
+                parse_arg_option_files_from(
+                    &args, argv[0], arg_s("--files-from"),
+                    arg_len == 12 ? NULL : argv[i] + 13, false
+                );
+                if(!args.valid) {
+                    break;
+                }
+            } else if(!arg_strncmp(argv[i], arg_s("--files0-from"), 13) &&
+                    (arg_len == 13 || argv[i][13] == arg_s('='))) {
+                parse_arg_option_files_from(
+                    &args, argv[0], arg_s("--files0-from"),
+                    arg_len == 13 ? NULL : argv[i] + 14, true
+                );
+                if(!args.valid) {
+                    break;
+                }
+            } else if(!arg_strcmp(argv[i], arg_s("--no-gitignore"))) {
+                args.gitignore = false;
+            } else if(!arg_strcmp(argv[i], arg_s("--no-gitattributes"))) {
+                args.gitattributes = false;
+            } else if(!arg_strncmp(argv[i], arg_s("--binary"), 8) &&
+                    (arg_len == 8 || argv[i][8] == arg_s('='))) {
+                parse_arg_option_binary(
+                    &args, argv[0], arg_len == 8 ? NULL : argv[i] + 9
+                );
+                if(!args.valid) {
+                    break;
+                }
             } else if(!arg_strcmp(argv[i], arg_s("--no-trailing-newline"))) {
                 args.trailing_newline = false;
             } else if(!arg_strcmp(argv[i], arg_s("--no-strip-whitespace"))) {
                 args.strip_whitespace = false;
             } else if(!arg_strcmp(argv[i], arg_s("--verbose"))) {
                 args.verbose = true;
+            } else if(!arg_strcmp(argv[i], arg_s("--check"))) {
+                args.check = true;
+            } else if(!arg_strcmp(argv[i], arg_s("--stdout"))) {
+                args.to_stdout = true;
+            } else if(!arg_strncmp(argv[i], arg_s("--stats"), 7) &&
+                    (arg_len == 7 || argv[i][7] == arg_s('='))) {
+                parse_arg_option_stats(
+                    &args, argv[0], arg_len == 7 ? NULL : argv[i] + 8
+                );
+                if(!args.valid) {
+                    break;
+                }
+            } else if(!arg_strncmp(argv[i], arg_s("--buffer-size"), 13) &&
+                    (arg_len == 13 || argv[i][13] == arg_s('='))) {
+                parse_arg_option_size(
+                    &args, argv[0], arg_s("--buffer-size"),
+                    arg_len == 13 ? NULL : argv[i] + 14, &args.buffer_size
+                );
+                if(!args.valid) {
+                    break;
+                }
+            } else if(!arg_strncmp(argv[i], arg_s("--pipeline-depth"), 16) &&
+                    (arg_len == 16 || argv[i][16] == arg_s('='))) {
+                parse_arg_option_count(
+                    &args, argv[0], arg_s("--pipeline-depth"),
+                    arg_len == 16 ? NULL : argv[i] + 17,
+                    &args.pipeline_depth
+                );
+                if(!args.valid) {
+                    break;
+                }
+            } else if(!arg_strcmp(argv[i], arg_s("--no-io-uring"))) {
+                args.io_uring = false;
+            } else if(!arg_strcmp(argv[i], arg_s("--atomic"))) {
+                parse_arg_option_atomic(&args, argv[0]);
+                if(!args.valid) {
+                    break;
+                }
             } else {
                 if(arg_len >= 2 && argv[i][1] == arg_s('-')) {
                     // Invalid long option
@@ -188,9 +554,36 @@ struct Arguments parse_args(int argc, arg_char** argv) {
                                     j = arg_len;
                                 }
                                 break;
+                            case arg_s('j'):
+                                if(j == arg_len - 1) {
+                                    if(i == argc - 1) {
+                                        // 'j' option without argument
+                                        parse_arg_option_jobs(
+                                            &args, argv[0], arg_s("j"), NULL
+                                        );
+                                    } else {
+                                        // 'j' option with space before
+                                        // argument
+                                        parse_arg_option_jobs(
+                                            &args, argv[0], arg_s("j"),
+                                            argv[++i]
+                                        );
+                                    }
+                                } else {
+                                    // 'j' option without space before argument
+                                    parse_arg_option_jobs(
+                                        &args, argv[0], arg_s("j"),
+                                        argv[i] + j + 1
+                                    );
+                                    j = arg_len;
+                                }
+                                break;
                             case arg_s('N'):
                                 args.trailing_newline = false;
                                 break;
+                            case arg_s('r'):
+                                parse_arg_option_recursive(&args, argv[0]);
+                                break;
                             case arg_s('S'):
                                 args.strip_whitespace = false;
                                 break;
@@ -213,13 +606,8 @@ struct Arguments parse_args(int argc, arg_char** argv) {
                         break;
                     }
                 } else {
-                    // Single '-'
-                    arg_printerr(
-                        arg_f arg_s(": processing of stdin is currently not ")
-                        arg_s("supported"), argv[0]
-                    );
-                    args.valid = false;
-                    break;
+                    // Single '-', meaning stdin
+                    parse_arg_file(&args, argv[i]);
                 }
             }
         } else {
@@ -228,16 +616,31 @@ struct Arguments parse_args(int argc, arg_char** argv) {
         }
     }
     if(!(display_help || display_version) && args.valid &&
-            args.num_filenames == 0) {
+            args.num_filenames == 0 && args.files_from == NULL) {
         // No filenames given
         arg_printerr(
             arg_f arg_s(": missing operand"), argv[0]
         );
         args.valid = false;
-    } else if((display_help || display_version || !args.valid) &&
-            args.num_filenames > 0) {
-        // Remove filenames from arguments if filenames were read but '--help'
-        // or '--version' were also given, or if there were invalid options
+    } else if(!(display_help || display_version) && args.valid &&
+            args.files_from != NULL && !arg_strcmp(args.files_from,
+            arg_s("-"))) {
+        // Stdin can't hold both the list of files and a file to process
+        for(size_t i = 0; i < args.num_filenames; ++i) {
+            if(!arg_strcmp(args.filenames[i], arg_s("-"))) {
+                arg_printerr(
+                    arg_f arg_s(": can't read both a list of files and a ")
+                    arg_s("file from stdin"), argv[0]
+                );
+                args.valid = false;
+                free_args(&args);
+                break;
+            }
+        }
+    } else if(display_help || display_version || !args.valid) {
+        // Remove filenames and globs from arguments if they were read but
+        // '--help' or '--version' were also given, or if there were invalid
+        // options
         free_args(&args);
     }
 
@@ -255,6 +658,10 @@ struct Arguments parse_args(int argc, arg_char** argv) {
             arg_s("Reformat newlines and remove trailing whitespace in ")
             arg_s("FILE(s)")
         );
+        arg_print(
+            arg_s("With FILE of -, read standard input and write to ")
+            arg_s("standard output.")
+        );
         arg_print(arg_s(""));
         arg_print(
             arg_s("  -t, --type=TYPE            ")
@@ -280,14 +687,182 @@ struct Arguments parse_args(int argc, arg_char** argv) {
             arg_s("                               ")
             arg_s("newlines")
         );
+        arg_print(
+            arg_s("  -r, --recursive            ")
+            arg_s("process files in directories and their")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("subdirectories")
+        );
+        arg_print(
+            arg_s("      --include=GLOB         ")
+            arg_s("when recursing, only process files whose names")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("match GLOB (may be given more than once)")
+        );
+        arg_print(
+            arg_s("      --exclude=GLOB         ")
+            arg_s("when recursing, skip files and directories whose")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("names match GLOB (may be given more than once)")
+        );
+        arg_print(
+            arg_s("      --no-gitignore         ")
+            arg_s("when recursing, don't skip files ignored by")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s(".gitignore files")
+        );
+        arg_print(
+            arg_s("      --no-gitattributes     ")
+            arg_s("when recursing, ignore the text and binary")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("attributes set by .gitattributes files")
+        );
+        arg_print(
+            arg_s("      --binary=ACTION        ")
+            arg_s("what to do with files which look like binary")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("data, must be one of 'skip', 'report' or")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("'process' (default: 'skip')")
+        );
         arg_print(
             arg_s("  -S, --no-strip-whitespace  ")
             arg_s("don't strip whitespace from the end of lines")
         );
+        arg_print(
+            arg_s("  -j, --jobs=N               ")
+            arg_s("process up to N files at once (default: the")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("number of online CPUs, ignored on Windows)")
+        );
         arg_print(
             arg_s("  -v, --verbose              ")
             arg_s("show whether or not changes are made to each file")
         );
+        arg_print(
+            arg_s("      --check                ")
+            arg_s("don't modify any files, instead list the files")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("which would be changed and exit with a failure")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("status if there are any")
+        );
+        arg_print(
+            arg_s("      --stdout               ")
+            arg_s("write the result of processing each file to")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("stdout instead of modifying it")
+        );
+        arg_print(
+            arg_s("      --stats[=json]         ")
+            arg_s("show bytes, lines, changes and time spent for")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("each file and in total, as JSON if given")
+        );
+        arg_print(
+            arg_s("      --buffer-size=SIZE     ")
+            arg_s("read and write files in buffers of SIZE bytes,")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("or KiB, MiB or GiB with a K, M or G suffix")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("(default: 64K)")
+        );
+        arg_print(
+            arg_s("      --pipeline-depth=N     ")
+            arg_s("read, process and write large files at the same")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("time, with up to N buffers between each, or one")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("at a time if N is 1 (default: 4)")
+        );
+        arg_print(
+            arg_s("      --no-io-uring          ")
+            arg_s("open, read, write and close small files one at a")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("time, rather than in batches through io_uring")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("when recursing or reading a list of files")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("(Linux only)")
+        );
+        arg_print(
+            arg_s("      --atomic               ")
+            arg_s("replace each changed file with a new file")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("holding the result, instead of rewriting it in")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("place (Linux only)")
+        );
+        arg_print(
+            arg_s("      --cache=FILE           ")
+            arg_s("remember files which need no changes in FILE,")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("and skip them in later runs while they're")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("unmodified")
+        );
+        arg_print(
+            arg_s("      --files-from=FILE      ")
+            arg_s("also process the files named on each line of")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("FILE, or of stdin if FILE is -")
+        );
+        arg_print(
+            arg_s("      --files0-from=FILE     ")
+            arg_s("same as --files-from, but names in FILE are")
+        );
+        arg_print(
+            arg_s("                               ")
+            arg_s("terminated by NUL characters")
+        );
         arg_print(
             arg_s("      --help                 ")
             arg_s("display this help and exit")
@@ -317,4 +892,16 @@ void free_args(struct Arguments* args) {
         args->filenames_capacity = 0;
         args->num_filenames = 0;
     }
+    if(args->includes != NULL) {
+        free(args->includes);
+        args->includes = NULL;
+        args->includes_capacity = 0;
+        args->num_includes = 0;
+    }
+    if(args->excludes != NULL) {
+        free(args->excludes);
+        args->excludes = NULL;
+        args->excludes_capacity = 0;
+        args->num_excludes = 0;
+    }
 }
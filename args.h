@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include "libnewline.h"
 
 #ifdef _WIN32
     #include <wchar.h>
@@ -17,6 +18,8 @@
     #define arg_fc              "%lc"
     #define arg_print(fmt, ...) wprintf(fmt L"\n", ##__VA_ARGS__)
     #define arg_printerr(fmt, ...) fwprintf(stderr, fmt "\n", ##__VA_ARGS__)
+    #define arg_fprint(file, fmt, ...) \
+        fwprintf(file, fmt L"\n", ##__VA_ARGS__)
     #define arg_strerror _wcserror
 #else
     typedef char arg_char;
@@ -29,14 +32,22 @@
     #define arg_fc              "%c"
     #define arg_print(fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
     #define arg_printerr(fmt, ...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
+    #define arg_fprint(file, fmt, ...) \
+        fprintf(file, fmt "\n", ##__VA_ARGS__)
     #define arg_strerror strerror
 #endif // _WIN32
 
-enum NewlineType {
-    LF,
-    CRLF,
-    CR,
-    KEEP
+enum StatsFormat {
+    STATS_NONE,
+    STATS_TEXT,
+    STATS_JSON
+};
+
+/* What to do with files which look like binary data */
+enum BinaryAction {
+    BINARY_SKIP,     // Leave them unchanged
+    BINARY_REPORT,   // Leave them unchanged, and fail for each one
+    BINARY_PROCESS   // Process them like any other file
 };
 
 struct Arguments {
@@ -44,6 +55,27 @@ struct Arguments {
     bool trailing_newline;         // !(--no-newline)
     bool strip_whitespace;         // !(--no-strip)
     bool verbose;                  // -v, --verbose
+    bool check;                    // --check
+    bool to_stdout;                // --stdout
+    bool atomic;                   // --atomic
+    enum StatsFormat stats;        // --stats
+    enum BinaryAction binary;      // --binary
+    const arg_char* cache;         // --cache (NULL if not given)
+    const arg_char* files_from;    // --files-from, --files0-from
+    bool files_from_nul;           // Names in 'files_from' end with NUL
+    size_t jobs;                   // -j, --jobs (0 if not given)
+    size_t buffer_size;            // --buffer-size
+    size_t pipeline_depth;         // --pipeline-depth
+    bool io_uring;                 // !(--no-io-uring)
+    bool recursive;                // -r, --recursive
+    bool gitignore;                // !(--no-gitignore)
+    bool gitattributes;            // !(--no-gitattributes)
+    size_t num_includes;           // Number of globs in 'includes'
+    size_t includes_capacity;      // Capacity of 'includes'
+    const arg_char** includes;     // --include
+    size_t num_excludes;           // Number of globs in 'excludes'
+    size_t excludes_capacity;      // Capacity of 'excludes'
+    const arg_char** excludes;     // --exclude
     bool valid;                    // Set to true if arguments were valid
     size_t num_filenames;          // Number of files in 'filenames'
     size_t filenames_capacity;     // Capacity of 'filenames'
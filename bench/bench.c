@@ -0,0 +1,488 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "corpus.h"
+
+#ifdef __linux__
+    #include <sys/ptrace.h>
+#endif // __linux__
+
+/* Number of times each combination of options is timed by default */
+static const unsigned DefaultRuns = 3;
+
+/* Size of each set of files generated by default (16MiB) */
+static const uint64_t DefaultSize = 16 * 1024 * 1024;
+
+/* Newline types to benchmark, each combined with and without '-N' and '-S' */
+static const char* const Types[] = {"lf", "crlf", "keep"};
+
+/* Resources used by one run of Newline */
+struct Measurement {
+    double seconds;         // Wall clock time
+    double user_seconds;
+    double sys_seconds;
+    long peak_rss_kib;
+};
+
+static void print_usage(const char* prog_name) {
+    fprintf(
+        stderr,
+        "Usage: %s [OPTION]... NEWLINE\n"
+        "Benchmark the Newline executable NEWLINE over generated files,\n"
+        "writing results to standard output as one JSON object per line.\n"
+        "\n"
+        "  --runs=N        time each combination of options N times "
+        "(default: %u)\n"
+        "  --size=MIB      generate about MIB MiB of files for each set "
+        "(default: %u)\n"
+        "  --set=NAME      only benchmark the set NAME; may be given more "
+        "than once\n"
+        "  --label=LABEL   label results with LABEL (default: NEWLINE)\n"
+        "  --work-dir=DIR  generate files in DIR (default: a new directory "
+        "here)\n"
+        "  --no-syscalls   don't count system calls\n"
+        "  --generate=DIR  only generate the sets in DIR, without "
+        "benchmarking\n"
+        "\n"
+        "Sets:\n",
+        prog_name, DefaultRuns, (unsigned)(DefaultSize / (1024 * 1024))
+    );
+    for(size_t i = 0; i < NumCorpusSets; ++i) {
+        fprintf(
+            stderr, "  %-15s %s\n",
+            CorpusSets[i].name, CorpusSets[i].description
+        );
+    }
+}
+
+static char* join_path(const char* dir, const char* name) {
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    char* path = malloc(dir_len + name_len + 2);
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+    return path;
+}
+
+static int remove_entry(const char* path, const struct stat* path_stat,
+                        int type, struct FTW* ftw) {
+    (void)path_stat;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+/* Deletes 'path' and everything in it, if it exists */
+static bool remove_tree(const char* path) {
+    struct stat path_stat;
+    if(lstat(path, &path_stat)) {
+        return errno == ENOENT;
+    }
+    return !nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static double elapsed(const struct timespec* start,
+                      const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) +
+        (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Discards the output of the calling process */
+static void silence(void) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    if(null_fd != -1) {
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+}
+
+/* Runs 'argv' and waits for it to exit, filling in 'measurement'. Returns
+false if it couldn't be run or didn't exit successfully. */
+static bool run_newline(char* const* argv, struct Measurement* measurement) {
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if(pid == -1) {
+        return false;
+    } else if(pid == 0) {
+        silence();
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if(wait4(pid, &status, 0, &usage) == -1) {
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *measurement = (struct Measurement){
+        .seconds = elapsed(&start, &end),
+        .user_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+        .sys_seconds = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6,
+#ifdef __APPLE__
+        // Reported in bytes rather than KiB
+        .peak_rss_kib = usage.ru_maxrss / 1024
+#else
+        .peak_rss_kib = usage.ru_maxrss
+#endif // __APPLE__
+    };
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+#ifdef __linux__
+/* Runs 'argv' under ptrace(), counting the system calls made by every thread.
+Much slower than a normal run, so isn't timed. Returns false if it couldn't be
+traced or didn't exit successfully. */
+static bool count_syscalls(char* const* argv, uint64_t* count) {
+    pid_t pid = fork();
+    if(pid == -1) {
+        return false;
+    } else if(pid == 0) {
+        silence();
+        if(ptrace(PTRACE_TRACEME, 0, NULL, NULL)) {
+            _exit(126);
+        }
+        raise(SIGSTOP);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    if(waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status)) {
+        return false;
+    }
+    ptrace(
+        PTRACE_SETOPTIONS, pid, NULL,
+        PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC |
+            PTRACE_O_EXITKILL
+    );
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+    *count = 0;
+    uint64_t stops = 0;
+    bool success = false;
+    pid_t stopped;
+    while((stopped = waitpid(-1, &status, __WALL)) != -1) {
+        if(WIFEXITED(status) || WIFSIGNALED(status)) {
+            if(stopped == pid) {
+                success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            }
+            continue;
+        }
+        int signal = 0;
+        if(WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            ++stops;
+#ifdef PTRACE_GET_SYSCALL_INFO
+            struct __ptrace_syscall_info info;
+            if(ptrace(
+                    PTRACE_GET_SYSCALL_INFO, stopped, sizeof(info), &info
+                    ) > 0 && info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+                ++*count;
+            }
+#endif // PTRACE_GET_SYSCALL_INFO
+        } else if(WSTOPSIG(status) != SIGSTOP && WSTOPSIG(status) != SIGTRAP) {
+            // Deliver any signal other than those stopping new threads or
+            // reporting ptrace events
+            signal = WSTOPSIG(status);
+        }
+        ptrace(PTRACE_SYSCALL, stopped, NULL, (void*)(intptr_t)signal);
+    }
+    if(*count == 0) {
+        // Entries and exits can't be told apart, but every system call
+        // stops at both, other than the final exit
+        *count = (stops + 1) / 2;
+    }
+    return success;
+}
+#endif // __linux__
+
+static int compare_doubles(const void* lhs_ptr, const void* rhs_ptr) {
+    double lhs = *(const double*)lhs_ptr;
+    double rhs = *(const double*)rhs_ptr;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/* Writes 'str' as a JSON string */
+static void print_json_string(const char* str) {
+    putchar('"');
+    for(const char* c = str; *c; ++c) {
+        if(*c == '"' || *c == '\\') {
+            printf("\\%c", *c);
+        } else if((unsigned char)*c < 0x20) {
+            printf("\\u%04x", *c);
+        } else {
+            putchar(*c);
+        }
+    }
+    putchar('"');
+}
+
+/* Options used to run the benchmarks */
+struct Bench {
+    const char* prog_name;
+    const char* newline;
+    const char* label;
+    unsigned runs;
+    bool syscalls;
+    const char* run_dir;    // Directory each run processes a copy of a set in
+};
+
+/* Benchmarks each combination of options over 'corpus', the files of 'set'
+generated in 'source_dir', writing a result for each. */
+static bool bench_set(const struct Bench* bench, const struct CorpusSet* set,
+                      const struct Corpus* corpus, const char* source_dir) {
+    struct Measurement* measurements = malloc(
+        bench->runs * sizeof(struct Measurement)
+    );
+    double* seconds = malloc(bench->runs * sizeof(double));
+    bool success = true;
+    for(size_t type = 0; success && type < sizeof(Types) / sizeof(Types[0]);
+            ++type) {
+        for(unsigned flags = 0; success && flags < 4; ++flags) {
+            bool no_trailing = flags & 1;
+            bool strip = !(flags & 2);
+            char options[32];
+            snprintf(
+                options, sizeof(options), "-t %s%s%s", Types[type],
+                no_trailing ? " -N" : "", strip ? "" : " -S"
+            );
+            const char* argv[8];
+            size_t argc = 0;
+            argv[argc++] = bench->newline;
+            argv[argc++] = "-rt";
+            argv[argc++] = Types[type];
+            if(no_trailing) {
+                argv[argc++] = "-N";
+            }
+            if(!strip) {
+                argv[argc++] = "-S";
+            }
+            argv[argc++] = "--";
+            argv[argc++] = bench->run_dir;
+            argv[argc] = NULL;
+
+            // Every run is given a fresh copy, as files are modified in place
+            long peak_rss_kib = 0;
+            for(unsigned run = 0; success && run < bench->runs; ++run) {
+                success = remove_tree(bench->run_dir) &&
+                    corpus_copy(corpus, source_dir, bench->run_dir);
+                if(!success) {
+                    fprintf(
+                        stderr, "%s: %s: %s\n",
+                        bench->prog_name, bench->run_dir, strerror(errno)
+                    );
+                    break;
+                }
+                success = run_newline(
+                    (char* const*)argv, &measurements[run]
+                );
+                if(!success) {
+                    fprintf(
+                        stderr, "%s: %s %s failed on %s\n",
+                        bench->prog_name, bench->newline, options, set->name
+                    );
+                    break;
+                }
+                seconds[run] = measurements[run].seconds;
+                if(measurements[run].peak_rss_kib > peak_rss_kib) {
+                    peak_rss_kib = measurements[run].peak_rss_kib;
+                }
+            }
+            if(!success) {
+                break;
+            }
+
+            bool counted = false;
+            uint64_t syscalls = 0;
+#ifdef __linux__
+            if(bench->syscalls) {
+                counted = remove_tree(bench->run_dir) &&
+                    corpus_copy(corpus, source_dir, bench->run_dir) &&
+                    count_syscalls((char* const*)argv, &syscalls);
+            }
+#endif // __linux__
+
+            // Report the run taking the median time, so one slow or fast run
+            // doesn't skew results
+            qsort(seconds, bench->runs, sizeof(double), compare_doubles);
+            double median = seconds[bench->runs / 2];
+            const struct Measurement* measurement = measurements;
+            for(unsigned run = 0; run < bench->runs; ++run) {
+                if(measurements[run].seconds == median) {
+                    measurement = &measurements[run];
+                }
+            }
+            double mib_per_s = corpus->bytes / (1024.0 * 1024.0) / median;
+            double files_per_s = corpus->num_files / median;
+
+            printf("{\"label\": ");
+            print_json_string(bench->label);
+            printf(", \"set\": ");
+            print_json_string(set->name);
+            printf(", \"options\": ");
+            print_json_string(options);
+            printf(
+                ", \"files\": %zu, \"bytes\": %llu, \"runs\": %u, "
+                "\"seconds\": %.6f, \"min_seconds\": %.6f, "
+                "\"mib_per_s\": %.3f, \"files_per_s\": %.1f, "
+                "\"user_seconds\": %.6f, \"sys_seconds\": %.6f, "
+                "\"peak_rss_kib\": %ld, ",
+                corpus->num_files, (unsigned long long)corpus->bytes,
+                bench->runs, median, seconds[0], mib_per_s, files_per_s,
+                measurement->user_seconds, measurement->sys_seconds,
+                peak_rss_kib
+            );
+            if(counted) {
+                printf("\"syscalls\": %llu}\n", (unsigned long long)syscalls);
+            } else {
+                printf("\"syscalls\": null}\n");
+            }
+            fflush(stdout);
+            fprintf(
+                stderr, "%-13s %-16s %10.1f MiB/s %10.0f files/s %8ld KiB\n",
+                set->name, options, mib_per_s, files_per_s, peak_rss_kib
+            );
+        }
+    }
+    free(seconds);
+    free(measurements);
+    return success;
+}
+
+int main(int argc, char** argv) {
+    struct Bench bench = {
+        .prog_name = argv[0],
+        .newline = NULL,
+        .label = NULL,
+        .runs = DefaultRuns,
+        .syscalls = true,
+        .run_dir = NULL
+    };
+    uint64_t size = DefaultSize;
+    const char* work_dir = NULL;
+    const char* generate_dir = NULL;
+    bool* selected = calloc(NumCorpusSets, sizeof(bool));
+    bool any_selected = false;
+    for(int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if(!strncmp(arg, "--runs=", 7) && atoi(arg + 7) > 0) {
+            bench.runs = atoi(arg + 7);
+        } else if(!strncmp(arg, "--size=", 7) && atoi(arg + 7) > 0) {
+            size = (uint64_t)atoi(arg + 7) * 1024 * 1024;
+        } else if(!strncmp(arg, "--set=", 6)) {
+            const struct CorpusSet* set = corpus_find(arg + 6);
+            if(set == NULL) {
+                fprintf(stderr, "%s: unknown set '%s'\n", argv[0], arg + 6);
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            selected[set - CorpusSets] = true;
+            any_selected = true;
+        } else if(!strncmp(arg, "--label=", 8)) {
+            bench.label = arg + 8;
+        } else if(!strncmp(arg, "--work-dir=", 11)) {
+            work_dir = arg + 11;
+        } else if(!strcmp(arg, "--no-syscalls")) {
+            bench.syscalls = false;
+        } else if(!strncmp(arg, "--generate=", 11)) {
+            generate_dir = arg + 11;
+        } else if(arg[0] != '-' && bench.newline == NULL) {
+            bench.newline = arg;
+        } else {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if(bench.newline == NULL && generate_dir == NULL) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if(bench.label == NULL) {
+        bench.label = bench.newline;
+    }
+    for(size_t i = 0; i < NumCorpusSets && !any_selected; ++i) {
+        selected[i] = true;
+    }
+
+    if(generate_dir != NULL) {
+        mkdir(generate_dir, 0777);
+        for(size_t i = 0; i < NumCorpusSets; ++i) {
+            if(!selected[i]) {
+                continue;
+            }
+            char* dir = join_path(generate_dir, CorpusSets[i].name);
+            struct Corpus corpus;
+            if(!corpus_generate(&CorpusSets[i], dir, size, &corpus)) {
+                fprintf(stderr, "%s: %s: %s\n", argv[0], dir, strerror(errno));
+                return EXIT_FAILURE;
+            }
+            fprintf(
+                stderr, "%-13s %8zu files %12llu bytes\n", CorpusSets[i].name,
+                corpus.num_files, (unsigned long long)corpus.bytes
+            );
+            corpus_free(&corpus);
+            free(dir);
+        }
+        free(selected);
+        return EXIT_SUCCESS;
+    }
+
+    char temp_dir[] = "newline-bench.XXXXXX";
+    if(work_dir == NULL) {
+        work_dir = mkdtemp(temp_dir);
+        if(work_dir == NULL) {
+            fprintf(
+                stderr, "%s: %s: %s\n", argv[0], temp_dir, strerror(errno)
+            );
+            return EXIT_FAILURE;
+        }
+    } else {
+        mkdir(work_dir, 0777);
+    }
+    char* run_dir = join_path(work_dir, "run");
+    bench.run_dir = run_dir;
+    bool success = true;
+    for(size_t i = 0; success && i < NumCorpusSets; ++i) {
+        if(!selected[i]) {
+            continue;
+        }
+        // Each set is generated once, then copied for every run
+        char* source_dir = join_path(work_dir, CorpusSets[i].name);
+        struct Corpus corpus;
+        success = corpus_generate(&CorpusSets[i], source_dir, size, &corpus);
+        if(success) {
+            success = bench_set(&bench, &CorpusSets[i], &corpus, source_dir);
+        } else {
+            fprintf(
+                stderr, "%s: %s: %s\n", argv[0], source_dir, strerror(errno)
+            );
+        }
+        remove_tree(source_dir);
+        corpus_free(&corpus);
+        free(source_dir);
+    }
+    remove_tree(run_dir);
+    free(run_dir);
+    if(work_dir == temp_dir) {
+        rmdir(work_dir);
+    }
+    free(selected);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,438 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "corpus.h"
+
+/* Size of the buffer used to copy files (1MiB) */
+static const size_t CopyBufferLen = 1024 * 1024;
+
+/* Number of files in each directory of sets with many files */
+static const size_t FilesPerDir = 256;
+
+/* Characters which make up words */
+static const char WordChars[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+    "_(){};,.=+-*/<>\"'#";
+
+/* Newlines to end lines with */
+enum Mix {
+    MIX_LF,
+    MIX_CRLF,
+    MIX_ANY    // Mostly LF and CRLF, with some CR
+};
+
+/* Shape of generated lines */
+struct LineStyle {
+    enum Mix mix;
+    size_t min_len;           // Length of text on a line, excluding indents
+    size_t max_len;           // and trailing whitespace
+    size_t max_indent;
+    unsigned trailing_pct;    // Chance of a line having trailing whitespace
+    size_t max_trailing;
+    unsigned space_pct;       // Chance of each character of text being a
+                              // space or tab
+};
+
+/* A file being generated from a pseudo-random sequence */
+struct Gen {
+    uint64_t state;
+    FILE* file;
+    uint64_t written;
+};
+
+/* Returns the next number in the sequence (SplitMix64) */
+static uint64_t gen_next(struct Gen* gen) {
+    uint64_t z = (gen->state += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+/* Returns a number from 'min' to 'max' inclusive */
+static uint64_t gen_range(struct Gen* gen, uint64_t min, uint64_t max) {
+    return min + gen_next(gen) % (max - min + 1);
+}
+
+/* Returns true 'pct' percent of the time */
+static bool gen_chance(struct Gen* gen, unsigned pct) {
+    return gen_next(gen) % 100 < pct;
+}
+
+static void gen_char(struct Gen* gen, char c) {
+    putc(c, gen->file);
+    ++gen->written;
+}
+
+static void gen_newline(struct Gen* gen, enum Mix mix) {
+    uint64_t pick = gen_next(gen) % 100;
+    if(mix == MIX_CRLF || (mix == MIX_ANY && pick < 45)) {
+        gen_char(gen, '\r');
+        gen_char(gen, '\n');
+    } else if(mix == MIX_ANY && pick >= 90) {
+        gen_char(gen, '\r');
+    } else {
+        gen_char(gen, '\n');
+    }
+}
+
+/* Writes 'len' spaces and tabs */
+static void gen_whitespace(struct Gen* gen, size_t len) {
+    for(size_t i = 0; i < len; ++i) {
+        gen_char(gen, gen_chance(gen, 75) ? ' ' : '\t');
+    }
+}
+
+/* Writes a line in the style 'style', including its newline */
+static void gen_line(struct Gen* gen, const struct LineStyle* style) {
+    size_t len = gen_range(gen, style->min_len, style->max_len);
+    if(len) {
+        gen_whitespace(gen, gen_range(gen, 0, style->max_indent));
+    }
+    for(size_t i = 0; i < len; ++i) {
+        if(i && i + 1 < len && gen_chance(gen, style->space_pct)) {
+            gen_char(gen, gen_chance(gen, 90) ? ' ' : '\t');
+        } else {
+            gen_char(gen, WordChars[gen_next(gen) % (sizeof(WordChars) - 1)]);
+        }
+    }
+    if(gen_chance(gen, style->trailing_pct)) {
+        gen_whitespace(gen, gen_range(gen, 1, style->max_trailing));
+    }
+    gen_newline(gen, style->mix);
+}
+
+/* Writes lines in the style 'style' until at least 'len' bytes have been
+written to the file */
+static void gen_lines(struct Gen* gen, const struct LineStyle* style,
+                      uint64_t len) {
+    while(gen->written < len) {
+        gen_line(gen, style);
+    }
+}
+
+static char* join_path(const char* dir, const char* name) {
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    char* path = malloc(dir_len + name_len + 2);
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+    return path;
+}
+
+static void add_path(char*** paths, size_t* num_paths, const char* path) {
+    *paths = realloc(*paths, (*num_paths + 1) * sizeof(char*));
+    (*paths)[(*num_paths)++] = strdup(path);
+}
+
+static bool make_dir(const char* path) {
+    return !mkdir(path, 0777) || errno == EEXIST;
+}
+
+/* Adds the directory 'name' to 'corpus', creating it in 'dir' */
+static bool corpus_dir(struct Corpus* corpus, const char* dir,
+                       const char* name) {
+    char* path = join_path(dir, name);
+    bool success = make_dir(path);
+    free(path);
+    if(success) {
+        add_path(&corpus->dirs, &corpus->num_dirs, name);
+    }
+    return success;
+}
+
+/* Starts generating the file 'name' of 'corpus' in 'dir' */
+static bool gen_open(struct Gen* gen, struct Corpus* corpus, const char* dir,
+                     const char* name) {
+    char* path = join_path(dir, name);
+    gen->file = fopen(path, "wb");
+    free(path);
+    gen->written = 0;
+    if(gen->file == NULL) {
+        return false;
+    }
+    add_path(&corpus->files, &corpus->num_files, name);
+    return true;
+}
+
+/* Finishes generating a file, adding its size to 'corpus' */
+static bool gen_close(struct Gen* gen, struct Corpus* corpus) {
+    bool success = !ferror(gen->file);
+    if(fclose(gen->file)) {
+        success = false;
+    }
+    gen->file = NULL;
+    corpus->bytes += gen->written;
+    return success;
+}
+
+/* Seeds the sequence for a set from its name, so each set differs */
+static struct Gen gen_seed(const char* name) {
+    uint64_t hash = 0xCBF29CE484222325;
+    for(const char* c = name; *c; ++c) {
+        hash = (hash ^ (uint8_t)*c) * 0x100000001B3;
+    }
+    return (struct Gen){.state = hash, .file = NULL, .written = 0};
+}
+
+/* Generates a single file of lines in the style 'style' */
+static bool gen_single(struct Corpus* corpus, const char* dir, uint64_t size,
+                       const char* name, const struct LineStyle* style) {
+    struct Gen gen = gen_seed(name);
+    if(!gen_open(&gen, corpus, dir, name)) {
+        return false;
+    }
+    gen_lines(&gen, style, size);
+    return gen_close(&gen, corpus);
+}
+
+static bool gen_lf(struct Corpus* corpus, const char* dir, uint64_t size) {
+    const struct LineStyle style = {
+        .mix = MIX_LF, .min_len = 1, .max_len = 100, .max_indent = 16,
+        .trailing_pct = 0, .max_trailing = 0, .space_pct = 15
+    };
+    // Already in the default format, so nothing needs changing
+    return gen_single(corpus, dir, size, "lf.txt", &style);
+}
+
+static bool gen_crlf(struct Corpus* corpus, const char* dir, uint64_t size) {
+    const struct LineStyle style = {
+        .mix = MIX_CRLF, .min_len = 0, .max_len = 100, .max_indent = 16,
+        .trailing_pct = 10, .max_trailing = 8, .space_pct = 15
+    };
+    return gen_single(corpus, dir, size, "crlf.txt", &style);
+}
+
+static bool gen_mixed(struct Corpus* corpus, const char* dir, uint64_t size) {
+    const struct LineStyle style = {
+        .mix = MIX_ANY, .min_len = 0, .max_len = 100, .max_indent = 16,
+        .trailing_pct = 20, .max_trailing = 16, .space_pct = 15
+    };
+    return gen_single(corpus, dir, size, "mixed.txt", &style);
+}
+
+static bool gen_dense(struct Corpus* corpus, const char* dir, uint64_t size) {
+    const struct LineStyle style = {
+        .mix = MIX_ANY, .min_len = 0, .max_len = 200, .max_indent = 32,
+        .trailing_pct = 80, .max_trailing = 64, .space_pct = 40
+    };
+    return gen_single(corpus, dir, size, "whitespace.txt", &style);
+}
+
+static bool gen_long_lines(struct Corpus* corpus, const char* dir,
+                           uint64_t size) {
+    const struct LineStyle style = {
+        .mix = MIX_ANY, .min_len = 256 * 1024, .max_len = 4 * 1024 * 1024,
+        .max_indent = 64, .trailing_pct = 50, .max_trailing = 4096,
+        .space_pct = 15
+    };
+    return gen_single(corpus, dir, size, "long-lines.txt", &style);
+}
+
+/* Generates text broken up by a line ending in a run of whitespace a quarter
+of the size of the file, and ending with a run of whitespace and newlines of
+the same size */
+static bool gen_trailing_run(struct Corpus* corpus, const char* dir,
+                             uint64_t size) {
+    const struct LineStyle style = {
+        .mix = MIX_LF, .min_len = 0, .max_len = 100, .max_indent = 16,
+        .trailing_pct = 5, .max_trailing = 8, .space_pct = 15
+    };
+    struct Gen gen = gen_seed("trailing-run.txt");
+    if(!gen_open(&gen, corpus, dir, "trailing-run.txt")) {
+        return false;
+    }
+    gen_lines(&gen, &style, size / 4);
+    gen_whitespace(&gen, size / 4);
+    gen_newline(&gen, MIX_LF);
+    gen_lines(&gen, &style, size * 3 / 4);
+    while(gen.written < size) {
+        if(gen_chance(&gen, 10)) {
+            gen_newline(&gen, MIX_ANY);
+        } else {
+            gen_whitespace(&gen, 1);
+        }
+    }
+    return gen_close(&gen, corpus);
+}
+
+/* Generates files in directories of 'FilesPerDir', with sizes from
+'size_for', until they total 'size' bytes. Lines are in the style 'style',
+and files end with anything from no newline to several. */
+static bool gen_many(struct Corpus* corpus, const char* dir, uint64_t size,
+                     const char* seed, const struct LineStyle* style,
+                     uint64_t (*size_for)(struct Gen* gen, uint64_t size)) {
+    struct Gen gen = gen_seed(seed);
+    char name[64];
+    uint64_t total = 0;
+    for(size_t i = 0; total < size; ++i) {
+        if(i % FilesPerDir == 0) {
+            snprintf(name, sizeof(name), "%04zu", i / FilesPerDir);
+            if(!corpus_dir(corpus, dir, name)) {
+                return false;
+            }
+        }
+        snprintf(
+            name, sizeof(name), "%04zu/%06zu.txt", i / FilesPerDir, i
+        );
+        if(!gen_open(&gen, corpus, dir, name)) {
+            return false;
+        }
+        uint64_t len = size_for(&gen, size);
+        while(gen.written < len) {
+            gen_line(&gen, style);
+        }
+        if(gen.written && gen_chance(&gen, 20)) {
+            // Extra newlines at the end of the file
+            for(uint64_t j = gen_range(&gen, 1, 4); j > 0; --j) {
+                gen_newline(&gen, style->mix);
+            }
+        } else if(gen.written && gen_chance(&gen, 20)) {
+            // No newline at the end of the file
+            for(uint64_t j = gen_range(&gen, 1, 16); j > 0; --j) {
+                gen_char(&gen, WordChars[gen_next(&gen) % 26]);
+            }
+        }
+        total += gen.written;
+        if(!gen_close(&gen, corpus)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Returns the size of a tiny file, under 512 bytes */
+static uint64_t tiny_size(struct Gen* gen, uint64_t size) {
+    (void)size;
+    return gen_range(gen, 0, 511);
+}
+
+static bool gen_tiny(struct Corpus* corpus, const char* dir, uint64_t size) {
+    const struct LineStyle style = {
+        .mix = MIX_ANY, .min_len = 0, .max_len = 60, .max_indent = 8,
+        .trailing_pct = 20, .max_trailing = 8, .space_pct = 15
+    };
+    // Making a file costs far more than its contents, so the total is kept
+    // small to keep the number of files reasonable
+    return gen_many(corpus, dir, size / 8, "tiny", &style, tiny_size);
+}
+
+/* Returns the size of a file spread evenly over powers of two, from a byte to
+a quarter of 'size' */
+static uint64_t varied_size(struct Gen* gen, uint64_t size) {
+    unsigned max_bits = 0;
+    while(((uint64_t)2 << max_bits) <= size / 4) {
+        ++max_bits;
+    }
+    uint64_t min = (uint64_t)1 << gen_range(gen, 0, max_bits);
+    return gen_range(gen, min, min * 2 - 1);
+}
+
+static bool gen_varied(struct Corpus* corpus, const char* dir,
+                       uint64_t size) {
+    const struct LineStyle style = {
+        .mix = MIX_ANY, .min_len = 0, .max_len = 120, .max_indent = 16,
+        .trailing_pct = 20, .max_trailing = 16, .space_pct = 15
+    };
+    return gen_many(corpus, dir, size, "varied", &style, varied_size);
+}
+
+const struct CorpusSet CorpusSets[] = {
+    {"lf", "LF newlines, no trailing whitespace", gen_lf},
+    {"crlf", "CRLF newlines, some trailing whitespace", gen_crlf},
+    {"mixed", "LF, CRLF and CR newlines, some trailing whitespace",
+        gen_mixed},
+    {"whitespace", "Dense whitespace, mostly trailing", gen_dense},
+    {"long-lines", "Lines from 256KiB to 4MiB long", gen_long_lines},
+    {"trailing-run", "Huge runs of trailing whitespace and newlines",
+        gen_trailing_run},
+    {"tiny-files", "Many files under 512 bytes", gen_tiny},
+    {"varied-files", "Files from a byte to a quarter of the size",
+        gen_varied}
+};
+const size_t NumCorpusSets = sizeof(CorpusSets) / sizeof(CorpusSets[0]);
+
+const struct CorpusSet* corpus_find(const char* name) {
+    for(size_t i = 0; i < NumCorpusSets; ++i) {
+        if(!strcmp(CorpusSets[i].name, name)) {
+            return &CorpusSets[i];
+        }
+    }
+    return NULL;
+}
+
+bool corpus_generate(const struct CorpusSet* set, const char* dir,
+                     uint64_t size, struct Corpus* corpus) {
+    *corpus = (struct Corpus){
+        .dirs = NULL,
+        .num_dirs = 0,
+        .files = NULL,
+        .num_files = 0,
+        .bytes = 0
+    };
+    return make_dir(dir) && set->generate(corpus, dir, size);
+}
+
+/* Copies the file 'from' to 'to' using 'buffer' */
+static bool copy_file(const char* from, const char* to, char* buffer) {
+    FILE* in = fopen(from, "rb");
+    if(in == NULL) {
+        return false;
+    }
+    FILE* out = fopen(to, "wb");
+    if(out == NULL) {
+        fclose(in);
+        return false;
+    }
+    size_t len;
+    bool success = true;
+    while(success && (len = fread(buffer, 1, CopyBufferLen, in)) > 0) {
+        success = fwrite(buffer, 1, len, out) == len;
+    }
+    success = success && !ferror(in);
+    fclose(in);
+    if(fclose(out)) {
+        success = false;
+    }
+    return success;
+}
+
+bool corpus_copy(const struct Corpus* corpus, const char* from,
+                 const char* to) {
+    if(!make_dir(to)) {
+        return false;
+    }
+    bool success = true;
+    for(size_t i = 0; success && i < corpus->num_dirs; ++i) {
+        char* path = join_path(to, corpus->dirs[i]);
+        success = make_dir(path);
+        free(path);
+    }
+    char* buffer = malloc(CopyBufferLen);
+    for(size_t i = 0; success && i < corpus->num_files; ++i) {
+        char* from_path = join_path(from, corpus->files[i]);
+        char* to_path = join_path(to, corpus->files[i]);
+        success = copy_file(from_path, to_path, buffer);
+        free(from_path);
+        free(to_path);
+    }
+    free(buffer);
+    return success;
+}
+
+void corpus_free(struct Corpus* corpus) {
+    for(size_t i = 0; i < corpus->num_dirs; ++i) {
+        free(corpus->dirs[i]);
+    }
+    for(size_t i = 0; i < corpus->num_files; ++i) {
+        free(corpus->files[i]);
+    }
+    free(corpus->dirs);
+    free(corpus->files);
+}
@@ -0,0 +1,49 @@
+#ifndef NEWLINE_BENCH_CORPUS_H
+#define NEWLINE_BENCH_CORPUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Files and directories making up a generated set of files, with paths
+relative to the directory the set was generated in. Directories come before
+anything inside them. */
+struct Corpus {
+    char** dirs;
+    size_t num_dirs;
+    char** files;
+    size_t num_files;
+    uint64_t bytes;    // Total size of every file
+};
+
+/* A set of files exercising one kind of input */
+struct CorpusSet {
+    const char* name;
+    const char* description;
+    // Generates about 'size' bytes of files in 'dir', which must exist
+    bool (*generate)(struct Corpus* corpus, const char* dir, uint64_t size);
+};
+
+extern const struct CorpusSet CorpusSets[];
+extern const size_t NumCorpusSets;
+
+/* Returns the set named 'name', or NULL if there isn't one. */
+const struct CorpusSet* corpus_find(const char* name);
+
+/* Generates 'set' in the directory 'dir', which is created if it doesn't
+exist, making about 'size' bytes of files. The same set, size and directory
+always give exactly the same files. Returns false with errno set if any file
+couldn't be written. */
+bool corpus_generate(const struct CorpusSet* set, const char* dir,
+                     uint64_t size, struct Corpus* corpus);
+
+/* Copies the files of 'corpus' from the directory 'from' to the directory
+'to', which is created if it doesn't exist. Returns false with errno set if
+any file couldn't be copied. */
+bool corpus_copy(const struct Corpus* corpus, const char* from,
+                 const char* to);
+
+/* Frees the paths in 'corpus' */
+void corpus_free(struct Corpus* corpus);
+
+#endif // NEWLINE_BENCH_CORPUS_H
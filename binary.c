@@ -0,0 +1,136 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+    #include <unistd.h>
+#endif // _WIN32
+#include "binary.h"
+
+/* Files whose samples contain control characters, and have more than one byte
+in this many which is either a control character or isn't part of a valid
+UTF-8 sequence, are binary */
+static const size_t BinarySuspectRatio = 8;
+
+/* The start of a binary file format */
+struct Magic {
+    const char* bytes;
+    size_t len;
+};
+
+#define MAGIC(bytes) {bytes, sizeof(bytes) - 1}
+
+/* Magic numbers of common binary formats. Most binary files have a NUL byte
+near their start anyway, but these are recognised even when they don't. */
+static const struct Magic BinaryMagics[] = {
+    MAGIC("\x89PNG\r\n\x1a\n"),
+    MAGIC("GIF87a"),
+    MAGIC("GIF89a"),
+    MAGIC("\xff\xd8\xff"),                 // JPEG
+    MAGIC("%PDF-"),
+    MAGIC("PK\x03\x04"),                   // ZIP, JAR and Office documents
+    MAGIC("\x1f\x8b"),                     // gzip
+    MAGIC("\xfd" "7zXZ"),                  // xz
+    MAGIC("\x28\xb5\x2f\xfd"),             // Zstandard
+    MAGIC("7z\xbc\xaf\x27\x1c"),
+    MAGIC("Rar!\x1a\x07"),
+    MAGIC("!<arch>\n"),                    // ar archives and static libraries
+    MAGIC("\x7f" "ELF"),
+    MAGIC("\xfe\xed\xfa\xce"),             // Mach-O
+    MAGIC("\xfe\xed\xfa\xcf"),
+    MAGIC("\xce\xfa\xed\xfe"),
+    MAGIC("\xcf\xfa\xed\xfe"),
+    MAGIC("\xca\xfe\xba\xbe")              // Java classes and fat Mach-O
+};
+
+/* Returns the length of the valid UTF-8 sequence at the start of the 'len'
+bytes at 'cur', 0 if it's invalid, or 'len' if it's cut short by the end */
+static size_t utf8_len(const uint8_t* cur, size_t len) {
+    size_t seq_len;
+    uint8_t min = 0x80;
+    uint8_t max = 0xbf;
+    if(cur[0] < 0x80) {
+        return 1;
+    } else if(cur[0] >= 0xc2 && cur[0] <= 0xdf) {
+        seq_len = 2;
+    } else if(cur[0] >= 0xe0 && cur[0] <= 0xef) {
+        // No overlong forms or surrogates
+        seq_len = 3;
+        min = cur[0] == 0xe0 ? 0xa0 : 0x80;
+        max = cur[0] == 0xed ? 0x9f : 0xbf;
+    } else if(cur[0] >= 0xf0 && cur[0] <= 0xf4) {
+        // No overlong forms, or code points past U+10FFFF
+        seq_len = 4;
+        min = cur[0] == 0xf0 ? 0x90 : 0x80;
+        max = cur[0] == 0xf4 ? 0x8f : 0xbf;
+    } else {
+        return 0;
+    }
+    for(size_t i = 1; i < seq_len; ++i) {
+        if(i == len) {
+            return len;
+        }
+        if(cur[i] < min || cur[i] > max) {
+            return 0;
+        }
+        min = 0x80;
+        max = 0xbf;
+    }
+    return seq_len;
+}
+
+/* Returns true if 'byte' is a control character text doesn't contain, which
+is any of them but whitespace and ESC */
+static bool is_control(uint8_t byte) {
+    return byte < 0x20 && memchr("\t\n\v\f\r\x1b", byte, 6) == NULL;
+}
+
+bool binary_detect(const uint8_t* sample, size_t len) {
+    for(size_t i = 0; i < sizeof(BinaryMagics) / sizeof(struct Magic); ++i) {
+        if(len >= BinaryMagics[i].len &&
+                !memcmp(sample, BinaryMagics[i].bytes, BinaryMagics[i].len)) {
+            return true;
+        }
+    }
+    if(memchr(sample, '\0', len) != NULL) {
+        return true;
+    }
+    // Text in legacy 8-bit encodings is rarely valid UTF-8, so invalid
+    // sequences only count along with control characters, which text doesn't
+    // have besides whitespace and ESC
+    size_t control = 0;
+    size_t invalid = 0;
+    size_t offset = 0;
+    while(offset < len) {
+        if(sample[offset] < 0x80) {
+            control += is_control(sample[offset]);
+            ++offset;
+            continue;
+        }
+        size_t seq_len = utf8_len(sample + offset, len - offset);
+        if(seq_len) {
+            offset += seq_len;
+        } else {
+            ++invalid;
+            ++offset;
+        }
+    }
+    return control && (control + invalid) * BinarySuspectRatio > len;
+}
+
+bool binary_file(FILE* file, uint8_t* sample) {
+#ifdef _WIN32
+    off_t position = ftello(file);
+    fseeko(file, 0, SEEK_SET);
+    size_t len = fread(sample, 1, BinarySampleLen, file);
+    fseeko(file, position, SEEK_SET);
+#else
+    // A positioned read leaves the stream's buffer and position alone
+    ssize_t len = pread(fileno(file), sample, BinarySampleLen, 0);
+    if(len <= 0) {
+        return false;
+    }
+#endif // _WIN32
+    return binary_detect(sample, len);
+}
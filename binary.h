@@ -0,0 +1,28 @@
+#ifndef NEWLINE_BINARY_H
+#define NEWLINE_BINARY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Bytes at the start of a file read to decide whether or not it's binary
+(8 KiB) */
+static const size_t BinarySampleLen = 8*1024;
+
+/* Returns true if the 'len' bytes at 'sample', the start of a file, look like
+binary data rather than text: if they start with the magic number of a common
+binary format (images, archives, compressed data, executables and object
+files), contain a NUL byte, or contain control characters other than
+whitespace and ESC which, along with bytes that aren't part of valid UTF-8
+sequences, make up too much of them. Text in other 8-bit encodings, such as
+ISO-8859-1 or Windows-1251, has no control characters, so isn't mistaken for
+binary data however many of its bytes aren't ASCII. */
+bool binary_detect(const uint8_t* sample, size_t len);
+
+/* Reads up to BinarySampleLen bytes from the start of 'file' into 'sample',
+leaving its position unchanged, and returns binary_detect() of them. 'file'
+must support seeking. Returns false if nothing could be read. */
+bool binary_file(FILE* file, uint8_t* sample);
+
+#endif // NEWLINE_BINARY_H
@@ -0,0 +1,406 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "cache.h"
+#include "trim.h"
+
+#ifdef __APPLE__
+    #define st_mtim st_mtimespec
+    #define st_ctim st_ctimespec
+#endif // __APPLE__
+
+/* Identifies a cache file, and the version of its format */
+static const char CacheMagic[8] = {'N', 'L', 'C', 'A', 'C', 'H', 'E', '2'};
+
+/* Files whose status changed less than this long before the run started
+(1 second) aren't recorded, since a change made within the resolution of the
+filesystem's timestamps could leave them looking unmodified */
+static const uint64_t CacheRacyNs = 1000000000;
+
+/* Start of a cache file, followed by 'num_entries' entries sorted by device
+then inode, then 'paths_len' bytes holding the path of each, ending with NUL.
+Everything is in the byte order of the machine which wrote it. */
+struct CacheHeader {
+    char magic[8];
+    uint32_t options;      // Options the entries are valid for
+    uint32_t entry_len;    // Size of each entry
+    uint64_t num_entries;
+    uint64_t paths_len;
+};
+
+/* An entry as stored in a cache file */
+struct CacheFileEntry {
+    struct CacheEntry entry;
+    uint64_t path;         // Offset of the file's path in the paths
+};
+
+/* Entries read from a cache file */
+struct CacheEntries {
+    struct CacheFileEntry* entries;  // Sorted, or NULL if there are none
+    size_t num_entries;
+    char* paths;
+};
+
+/* Whether or not a file seen by this run needs no changes */
+struct CacheRecord {
+    struct CacheEntry entry;
+    char* path;            // Absolute path of the file
+    bool conforms;
+};
+
+struct Cache {
+    const char* path;
+    char* cwd;                     // Directory names are relative to
+    uint32_t options;
+    uint64_t start_ns;             // Time the cache was opened
+    struct CacheEntries loaded;
+    uint8_t* seen;                 // Whether this run saw each loaded entry
+    struct CacheRecord* records;   // Files seen by this run
+    size_t num_records;
+    size_t records_capacity;
+};
+
+/* Returns the options in 'args' which affect whether or not a file needs
+changes */
+static uint32_t cache_options(const struct Arguments* args) {
+    return (uint32_t)args->newline_type | (args->trailing_newline << 8) |
+        (args->strip_whitespace << 9);
+}
+
+/* Orders entries by device, then inode */
+static int compare_entries(const void* lhs_ptr, const void* rhs_ptr) {
+    const struct CacheEntry* lhs = lhs_ptr;
+    const struct CacheEntry* rhs = rhs_ptr;
+    if(lhs->dev != rhs->dev) {
+        return lhs->dev < rhs->dev ? -1 : 1;
+    }
+    if(lhs->ino != rhs->ino) {
+        return lhs->ino < rhs->ino ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Reads the entries of the cache file 'path' into 'loaded' if it was made with
+'options'. Leaves 'loaded' empty if there are none. */
+static void load_entries(const char* path, uint32_t options,
+                         struct CacheEntries* loaded) {
+    *loaded = (struct CacheEntries){
+        .entries = NULL,
+        .num_entries = 0,
+        .paths = NULL
+    };
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) {
+        return;
+    }
+    struct CacheHeader header;
+    if(fread(&header, sizeof(header), 1, file) != 1 ||
+            memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) ||
+            header.options != options ||
+            header.entry_len != sizeof(struct CacheFileEntry) ||
+            header.num_entries == 0 || header.paths_len == 0 ||
+            header.num_entries > SIZE_MAX / sizeof(struct CacheFileEntry) ||
+            header.paths_len > SIZE_MAX) {
+        fclose(file);
+        return;
+    }
+    struct CacheFileEntry* entries = malloc(
+        header.num_entries * sizeof(struct CacheFileEntry)
+    );
+    char* paths = malloc(header.paths_len);
+    bool valid = entries != NULL && paths != NULL && fread(
+            entries, sizeof(struct CacheFileEntry), header.num_entries, file
+            ) == header.num_entries &&
+        fread(paths, 1, header.paths_len, file) == header.paths_len &&
+        paths[header.paths_len - 1] == '\0';
+    for(uint64_t i = 0; valid && i < header.num_entries; ++i) {
+        valid = entries[i].path < header.paths_len;
+    }
+    fclose(file);
+    if(!valid) {
+        free(entries);
+        free(paths);
+        return;
+    }
+    loaded->entries = entries;
+    loaded->num_entries = header.num_entries;
+    loaded->paths = paths;
+}
+
+struct Cache* cache_open(const char* path, const struct Arguments* args) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct Cache* cache = malloc(sizeof(struct Cache));
+    *cache = (struct Cache){
+        .path = path,
+        .options = cache_options(args),
+        .start_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec,
+        .seen = NULL,
+        .records = NULL,
+        .num_records = 0,
+        .records_capacity = 0
+    };
+    // Paths are stored absolute, so runs from other directories can check
+    // them
+    cache->cwd = getcwd(NULL, 0);
+    load_entries(path, cache->options, &cache->loaded);
+    cache->seen = calloc(cache->loaded.num_entries + 1, sizeof(uint8_t));
+    return cache;
+}
+
+void cache_entry(const struct stat* file_stat, struct CacheEntry* entry) {
+    *entry = (struct CacheEntry){
+        .dev = file_stat->st_dev,
+        .ino = file_stat->st_ino,
+        .size = file_stat->st_size,
+        .mtime_ns = (uint64_t)file_stat->st_mtim.tv_sec * 1000000000 +
+            file_stat->st_mtim.tv_nsec,
+        .ctime_ns = (uint64_t)file_stat->st_ctim.tv_sec * 1000000000 +
+            file_stat->st_ctim.tv_nsec
+    };
+}
+
+/* Returns the loaded entry for the same file as 'entry', or NULL if there
+isn't one */
+static struct CacheFileEntry* loaded_entry(const struct Cache* cache,
+                                           const struct CacheEntry* entry) {
+    // Entries start with the identity of their file, so can be compared the
+    // same way
+    return bsearch(
+        entry, cache->loaded.entries, cache->loaded.num_entries,
+        sizeof(struct CacheFileEntry), compare_entries
+    );
+}
+
+bool cache_contains(const struct Cache* cache,
+                    const struct CacheEntry* entry) {
+    const struct CacheFileEntry* found = loaded_entry(cache, entry);
+    if(found == NULL || found->entry.size != entry->size ||
+            found->entry.mtime_ns != entry->mtime_ns ||
+            found->entry.ctime_ns != entry->ctime_ns) {
+        return false;
+    }
+    // Several threads may mark the same entry, which is harmless
+    __atomic_store_n(
+        &cache->seen[found - cache->loaded.entries], 1, __ATOMIC_RELAXED
+    );
+    return true;
+}
+
+/* Returns the absolute path of 'name', which the caller must free */
+static char* absolute_path(const struct Cache* cache, const char* name) {
+    if(name[0] == '/' || cache->cwd == NULL) {
+        return strdup(name);
+    }
+    size_t cwd_len = strlen(cache->cwd);
+    size_t name_len = strlen(name);
+    char* path = malloc(cwd_len + name_len + 2);
+    memcpy(path, cache->cwd, cwd_len);
+    path[cwd_len] = '/';
+    memcpy(path + cwd_len + 1, name, name_len + 1);
+    return path;
+}
+
+void cache_record(struct Cache* cache, const struct CacheEntry* entry,
+                  const char* name, bool conforms) {
+    if(conforms && (entry->ctime_ns + CacheRacyNs > cache->start_ns ||
+            entry->mtime_ns + CacheRacyNs > cache->start_ns)) {
+        return;
+    }
+    if(conforms ? cache_contains(cache, entry) :
+            loaded_entry(cache, entry) == NULL) {
+        // Nothing to add or remove
+        return;
+    }
+    if(cache->num_records == cache->records_capacity) {
+        cache->records_capacity = cache->records_capacity ?
+            cache->records_capacity * 2 : 64;
+        cache->records = realloc(
+            cache->records,
+            cache->records_capacity * sizeof(struct CacheRecord)
+        );
+    }
+    cache->records[cache->num_records++] = (struct CacheRecord){
+        .entry = *entry,
+        .path = absolute_path(cache, name),
+        .conforms = conforms
+    };
+}
+
+/* Returns true if the entry 'file_entry' of 'disk', the entries on disk, is
+still worth keeping: if this run saw the file it describes, or a file with the
+same device and inode is still at its path */
+static bool entry_current(const struct Cache* cache,
+                          const struct CacheEntries* disk,
+                          const struct CacheFileEntry* file_entry) {
+    const struct CacheFileEntry* loaded = loaded_entry(
+        cache, &file_entry->entry
+    );
+    if(loaded != NULL && cache->seen[loaded - cache->loaded.entries]) {
+        return true;
+    }
+    struct stat file_stat;
+    return !stat(disk->paths + file_entry->path, &file_stat) &&
+        (uint64_t)file_stat.st_dev == file_entry->entry.dev &&
+        (uint64_t)file_stat.st_ino == file_entry->entry.ino;
+}
+
+/* Writes 'entry' to 'file' along with its path, which is added to 'paths' */
+static void write_entry(const struct CacheEntry* entry, const char* path,
+                        struct TrimBuffer* paths, FILE* file) {
+    struct CacheFileEntry file_entry = {.entry = *entry, .path = paths->len};
+    size_t path_len = strlen(path) + 1;
+    trim_reserve(paths, path_len);
+    memcpy(paths->data + paths->len, path, path_len);
+    paths->len += path_len;
+    fwrite(&file_entry, sizeof(struct CacheFileEntry), 1, file);
+}
+
+/* Writes 'disk', the entries on disk, merged with the records of 'cache' to
+'file'. Records replace entries for the same file, and are left out if they
+don't conform. Entries are left out unless 'keep' is true for them. Records
+must be sorted. */
+static bool write_merged(const struct Cache* cache,
+                         const struct CacheEntries* disk, const bool* keep,
+                         FILE* file) {
+    struct CacheHeader header;
+    memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+    header.options = cache->options;
+    header.entry_len = sizeof(struct CacheFileEntry);
+    header.num_entries = 0;
+    header.paths_len = 0;
+    fwrite(&header, sizeof(header), 1, file);
+
+    struct TrimBuffer paths = {0};
+    size_t entry_i = 0;
+    size_t record_i = 0;
+    while(entry_i < disk->num_entries || record_i < cache->num_records) {
+        int cmp = -1;
+        if(entry_i == disk->num_entries) {
+            cmp = 1;
+        } else if(record_i < cache->num_records) {
+            cmp = compare_entries(
+                &disk->entries[entry_i], &cache->records[record_i].entry
+            );
+        }
+        if(cmp < 0) {
+            const struct CacheFileEntry* file_entry = &disk->entries[entry_i];
+            if(keep[entry_i++]) {
+                write_entry(
+                    &file_entry->entry, disk->paths + file_entry->path,
+                    &paths, file
+                );
+                ++header.num_entries;
+            }
+        } else {
+            if(cmp == 0) {
+                ++entry_i;
+            }
+            // A file seen more than once only conforms if it always did
+            const struct CacheRecord* record = &cache->records[record_i++];
+            bool conforms = record->conforms;
+            while(record_i < cache->num_records && !compare_entries(
+                    &record->entry, &cache->records[record_i].entry)) {
+                conforms = cache->records[record_i++].conforms && conforms;
+            }
+            if(conforms) {
+                write_entry(&record->entry, record->path, &paths, file);
+                ++header.num_entries;
+            }
+        }
+    }
+    fwrite(paths.data, 1, paths.len, file);
+    header.paths_len = paths.len;
+    free(paths.data);
+    if(fseeko(file, 0, SEEK_SET)) {
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    return !fflush(file) && !ferror(file);
+}
+
+bool cache_close(struct Cache* cache) {
+    // Merge with whatever is on disk now, which may include entries saved by
+    // other runs since the cache was loaded
+    struct CacheEntries disk;
+    load_entries(cache->path, cache->options, &disk);
+    // Records start with their entry, so can be sorted the same way
+    qsort(
+        cache->records, cache->num_records, sizeof(struct CacheRecord),
+        compare_entries
+    );
+
+    // Entries for files which were deleted or replaced are dropped, so the
+    // cache doesn't keep growing as the tree changes. Those replaced by
+    // records needn't be checked.
+    bool* keep = malloc((disk.num_entries + 1) * sizeof(bool));
+    size_t num_dropped = 0;
+    for(size_t i = 0; i < disk.num_entries; ++i) {
+        keep[i] = bsearch(
+            &disk.entries[i].entry, cache->records, cache->num_records,
+            sizeof(struct CacheRecord), compare_entries
+        ) != NULL || entry_current(cache, &disk, &disk.entries[i]);
+        num_dropped += !keep[i];
+    }
+
+    bool success = true;
+    if(cache->num_records || num_dropped) {
+        // Write a new cache beside the old one, then rename it into place
+        size_t path_len = strlen(cache->path);
+        char* temp_path = malloc(path_len + 8);
+        memcpy(temp_path, cache->path, path_len);
+        memcpy(temp_path + path_len, ".XXXXXX", 8);
+        int fd = mkstemp(temp_path);
+        FILE* file = NULL;
+        if(fd != -1) {
+            // Give the cache the permissions a newly created file would have
+            mode_t mask = umask(0);
+            umask(mask);
+            fchmod(fd, 0666 & ~mask);
+            file = fdopen(fd, "wb");
+            if(file == NULL) {
+                close(fd);
+                unlink(temp_path);
+            }
+        }
+        if(file == NULL) {
+            success = false;
+        } else {
+            success = write_merged(cache, &disk, keep, file);
+            int error = errno;
+            if(fclose(file)) {
+                success = false;
+                error = errno;
+            }
+            if(success && rename(temp_path, cache->path)) {
+                success = false;
+                error = errno;
+            }
+            if(!success) {
+                unlink(temp_path);
+                errno = error;
+            }
+        }
+        free(temp_path);
+    }
+    free(keep);
+    free(disk.entries);
+    free(disk.paths);
+    for(size_t i = 0; i < cache->num_records; ++i) {
+        free(cache->records[i].path);
+    }
+    free(cache->loaded.entries);
+    free(cache->loaded.paths);
+    free(cache->seen);
+    free(cache->records);
+    free(cache->cwd);
+    free(cache);
+    return success;
+}
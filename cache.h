@@ -0,0 +1,50 @@
+#ifndef NEWLINE_CACHE_H
+#define NEWLINE_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "args.h"
+
+/* Identifies a version of a file. If any of these change, the file may have
+been modified. */
+struct CacheEntry {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime_ns;  // Modification time in nanoseconds
+    uint64_t ctime_ns;  // Status change time in nanoseconds
+};
+
+struct Cache;
+
+/* Loads the cache file 'path', which records files known to need no changes
+when processed with the options in 'args'. A cache which doesn't exist, can't
+be read, or was made with different options, is treated as empty. */
+struct Cache* cache_open(const char* path, const struct Arguments* args);
+
+/* Fills in 'entry' from 'file_stat' */
+void cache_entry(const struct stat* file_stat, struct CacheEntry* entry);
+
+/* Returns true if the file 'entry' describes is known to need no changes.
+Safe to call from several threads at once, as the cache loaded isn't modified
+until it's saved, apart from noting which entries were seen. */
+bool cache_contains(const struct Cache* cache, const struct CacheEntry* entry);
+
+/* Records whether or not the file 'entry' describes, named 'name', needs no
+changes, to be saved by cache_close(). Not safe to call from several threads at
+once. Files whose status changed too recently to be sure a later change would
+be seen aren't recorded. */
+void cache_record(struct Cache* cache, const struct CacheEntry* entry,
+                  const char* name, bool conforms);
+
+/* Saves the cache if anything was recorded or any entries are out of date,
+then frees it. Entries saved by other runs since the cache was opened are
+merged with those recorded. Entries for files this run didn't see are dropped
+if their path no longer names the same file, so files which were deleted or
+replaced don't stay in the cache. The cache file is replaced atomically with
+rename(), so runs sharing a cache never see it partly written. Returns false
+with errno set if the cache couldn't be saved. */
+bool cache_close(struct Cache* cache);
+
+#endif // NEWLINE_CACHE_H
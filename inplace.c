@@ -0,0 +1,626 @@
+#ifdef __linux__
+    #define _GNU_SOURCE // copy_file_range()
+#endif // __linux__
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "args.h"
+#include "inplace.h"
+#include "scan.h"
+#include "tempfile.h"
+#include "trim.h"
+
+#ifdef _WIN32
+    #define delete(file) _wunlink(file)
+#else
+    #define delete(file) unlink(file)
+#endif // _WIN32
+
+/* Length of the blocks the end of a file is read backwards in by trim_tail(),
+which usually only needs the last few bytes (4 KiB) */
+static const size_t TailBlockLen = 4*1024;
+
+/* Most output which can be held in memory while waiting for the input to be
+read past where it will be written (4 MiB) */
+static const size_t InPlaceLookahead = 4*1024*1024;
+
+struct InPlace {
+    FILE* file;
+    const arg_char* name;
+    off_t read;               // Input before this offset has been read
+    struct Scratch* scratch;
+    FILE* spill;              // Receives the output once lookahead runs out
+    off_t spill_offset;       // Offset in 'file' of the start of 'spill'
+};
+
+/* Truncates 'file' to nothing, leaving its position at the start */
+static void empty_file(FILE* file) {
+    fflush(file);
+    ftruncate(fileno(file), 0);
+    fseeko(file, 0, SEEK_SET);
+    clearerr(file);
+}
+
+/* Closes and deletes the temporary file of 'scratch' */
+static void scratch_free_temp_file(struct Scratch* scratch) {
+    fclose(scratch->temp->file);
+    if(scratch->temp->filename != NULL) {
+        delete(scratch->temp->filename);
+    }
+    free_temp_file(scratch->temp);
+    scratch->temp = NULL;
+}
+
+void scratch_free(struct Scratch* scratch) {
+    free(scratch->in.data);
+    free(scratch->out.data);
+    if(scratch->temp != NULL) {
+        scratch_free_temp_file(scratch);
+    }
+}
+
+FILE* scratch_temp_file(struct Scratch* scratch, FILE* file,
+                        const arg_char* name) {
+#ifdef __linux__
+    // Keep the temporary file on the same filesystem as 'file', so copying
+    // between them stays within one filesystem
+    struct stat file_stat;
+    struct stat temp_stat;
+    if(scratch->temp != NULL && !fstat(fileno(file), &file_stat) &&
+            !fstat(fileno(scratch->temp->file), &temp_stat) &&
+            file_stat.st_dev != temp_stat.st_dev) {
+        scratch_free_temp_file(scratch);
+    }
+    if(scratch->temp == NULL) {
+        scratch->temp = make_temp_file_beside(name, ".newline_%.tmp");
+    }
+#else
+    (void)file;
+    (void)name;
+#endif // __linux__
+    if(scratch->temp == NULL) {
+        scratch->temp = make_temp_file("newline_%.tmp");
+    }
+    if(scratch->temp == NULL) {
+        return NULL;
+    }
+    empty_file(scratch->temp->file);
+    return scratch->temp->file;
+}
+
+void scratch_release_temp_file(struct Scratch* scratch) {
+    if(scratch->temp != NULL) {
+        empty_file(scratch->temp->file);
+    }
+}
+
+bool write_file_at(FILE* file, const uint8_t* data, size_t len,
+                   off_t offset) {
+#ifdef _WIN32
+    fseeko(file, offset, SEEK_SET);
+    return fwrite(data, 1, len, file) == len;
+#else
+    while(len) {
+        ssize_t written = pwrite(fileno(file), data, len, offset);
+        if(written < 0) {
+            return false;
+        } else if(!written) {
+            errno = EIO;
+            return false;
+        }
+        data += written;
+        len -= written;
+        offset += written;
+    }
+    return true;
+#endif // _WIN32
+}
+
+/* Writes or skips the decided output in 'out', never writing past the end of
+the input read so far unless 'finished' is true. */
+static void write_decided(struct InPlace* in_place, struct TrimState* state,
+                          struct TrimBuffer* out, bool finished) {
+    size_t decided = trim_decided(state, out);
+    if(in_place->spill != NULL) {
+        fwrite(out->data, 1, decided, in_place->spill);
+        trim_release(state, out, decided);
+        return;
+    }
+
+    // Output before the first change is identical to the input
+    size_t identical = decided;
+    if(trim_changed(state)) {
+        identical = 0;
+        if(state->first_change > state->flushed) {
+            identical = state->first_change - state->flushed;
+        }
+        if(identical > decided) {
+            identical = decided;
+        }
+    }
+    trim_release(state, out, identical);
+    decided -= identical;
+
+    size_t write_len = 0;
+    if(finished) {
+        write_len = decided;
+    } else if(in_place->read > state->flushed) {
+        write_len = in_place->read - state->flushed;
+        if(write_len > decided) {
+            write_len = decided;
+        }
+    }
+    if(write_len) {
+        if(!write_file_at(
+                in_place->file, out->data, write_len, state->flushed)) {
+            in_place->scratch->error = errno;
+        }
+        trim_release(state, out, write_len);
+        decided -= write_len;
+    }
+
+    if(decided > InPlaceLookahead) {
+        // The output has grown too far past the input, so send the rest of
+        // it to a temporary file. If one can't be created, just keep holding
+        // the output in memory.
+        in_place->spill = scratch_temp_file(
+            in_place->scratch, in_place->file, in_place->name
+        );
+        if(in_place->spill != NULL) {
+            in_place->spill_offset = state->flushed;
+            fwrite(out->data, 1, decided, in_place->spill);
+            trim_release(state, out, decided);
+        }
+    }
+}
+
+bool copy_file_into(FILE* file, off_t offset, FILE* source,
+                    struct TrimBuffer* buffer) {
+    if(fflush(source) || ferror(source)) {
+        return false;
+    }
+    fseeko(source, 0, SEEK_SET);
+#ifdef __linux__
+    // Let the kernel copy the data, falling back to copying it through a
+    // buffer if the files are on filesystems it can't copy between
+    off_t source_offset = 0;
+    while(true) {
+        ssize_t copied = copy_file_range(
+            fileno(source), &source_offset, fileno(file), &offset,
+            SIZE_MAX >> 1, 0
+        );
+        if(copied <= 0) {
+            break;
+        }
+    }
+    fseeko(source, source_offset, SEEK_SET);
+#endif // __linux__
+    buffer->len = 0;
+    trim_reserve(buffer, FileBufferLen);
+    size_t read_bytes = fread(buffer->data, 1, FileBufferLen, source);
+    while(read_bytes) {
+        if(!write_file_at(file, buffer->data, read_bytes, offset)) {
+            return false;
+        }
+        offset += read_bytes;
+        read_bytes = fread(buffer->data, 1, FileBufferLen, source);
+    }
+    return !ferror(source);
+}
+
+/* Copies the temporary file the output was spilled to into place. */
+static void copy_spill(struct InPlace* in_place) {
+    if(!copy_file_into(
+            in_place->file, in_place->spill_offset, in_place->spill,
+            &in_place->scratch->in)) {
+        in_place->scratch->error = errno;
+    }
+    scratch_release_temp_file(in_place->scratch);
+    in_place->spill = NULL;
+}
+
+bool trim_in_place(FILE* file, const arg_char* name, const uint8_t* map,
+                   size_t map_len, struct Scratch* scratch,
+                   enum NewlineType newline_type, bool trailing_newline,
+                   bool strip, struct TrimStats* stats) {
+    struct InPlace in_place = {
+        .file = file,
+        .name = name,
+        .read = 0,
+        .scratch = scratch,
+        .spill = NULL,
+        .spill_offset = 0
+    };
+    struct TrimState state;
+    trim_init(&state, newline_type, trailing_newline, strip);
+    struct TrimBuffer* out = &scratch->out;
+    out->len = 0;
+    uint8_t* block = NULL;
+    if(map == NULL) {
+        scratch->in.len = 0;
+        trim_reserve(&scratch->in, TrimBlockLen);
+        block = scratch->in.data;
+    }
+
+    uint64_t mark = trim_lap_start(stats);
+    while(true) {
+        const uint8_t* in;
+        size_t in_len;
+        if(map != NULL) {
+            in = map + in_place.read;
+            in_len = map_len - in_place.read;
+            if(in_len > TrimBlockLen) {
+                in_len = TrimBlockLen;
+            }
+        } else {
+            fseeko(file, in_place.read, SEEK_SET);
+            in = block;
+            in_len = fread(block, 1, TrimBlockLen, file);
+            trim_lap(stats, TRIM_READ, &mark);
+        }
+        if(!in_len) {
+            break;
+        }
+        in_place.read += in_len;
+        trim_block(&state, in, in_len, out);
+        trim_lap(stats, TRIM_TRANSFORM, &mark);
+        write_decided(&in_place, &state, out, false);
+        trim_lap(stats, TRIM_WRITE, &mark);
+    }
+    trim_finish(&state, out);
+    trim_lap(stats, TRIM_TRANSFORM, &mark);
+    write_decided(&in_place, &state, out, true);
+    if(in_place.spill != NULL) {
+        copy_spill(&in_place);
+    }
+
+    if(trim_changed(&state)) {
+        fflush(file);
+        if(state.flushed < in_place.read &&
+                ftruncate(fileno(file), state.flushed)) {
+            scratch->error = errno;
+        }
+    }
+    trim_lap(stats, TRIM_WRITE, &mark);
+    if(stats != NULL) {
+        stats->bytes_read += in_place.read;
+        if(trim_changed(&state)) {
+            stats->bytes_written += state.flushed - state.first_change;
+        }
+        trim_tally(stats, &state);
+    }
+    return trim_changed(&state);
+}
+
+bool trim_small(FILE* file, bool check, struct Scratch* scratch,
+                enum NewlineType newline_type, bool trailing_newline,
+                bool strip, struct TrimStats* stats) {
+    struct TrimBuffer* in = &scratch->in;
+    struct TrimBuffer* out = &scratch->out;
+    // Read the whole file, in case it's grown since its size was checked
+    uint64_t mark = trim_lap_start(stats);
+    in->len = 0;
+    while(true) {
+        if(in->len == in->capacity) {
+            in->capacity = in->capacity ? in->capacity * 2 : SmallFileMax;
+            in->data = realloc(in->data, in->capacity);
+        }
+        size_t read_bytes = fread(
+            in->data + in->len, 1, in->capacity - in->len, file
+        );
+        if(!read_bytes) {
+            break;
+        }
+        in->len += read_bytes;
+    }
+
+    trim_lap(stats, TRIM_READ, &mark);
+    if(stats != NULL) {
+        stats->bytes_read += in->len;
+    }
+
+    off_t first_change = trim_whole(
+        in->data, in->len, out, check, newline_type, trailing_newline, strip,
+        stats
+    );
+    mark = trim_lap_start(stats);
+    if(check || first_change == -1) {
+        return first_change != -1;
+    }
+
+    if(!write_file_at(
+            file, out->data + first_change, out->len - first_change,
+            first_change)) {
+        scratch->error = errno;
+    }
+    if(out->len < in->len) {
+        fflush(file);
+        if(ftruncate(fileno(file), out->len)) {
+            scratch->error = errno;
+        }
+    }
+    trim_lap(stats, TRIM_WRITE, &mark);
+    if(stats != NULL) {
+        stats->bytes_written += out->len - first_change;
+    }
+    return true;
+}
+
+off_t trim_whole(const uint8_t* in, size_t in_len, struct TrimBuffer* out,
+                 bool check, enum NewlineType newline_type,
+                 bool trailing_newline, bool strip, struct TrimStats* stats) {
+    // Nothing is released, so all of the output stays in 'out'
+    uint64_t mark = trim_lap_start(stats);
+    struct TrimState state;
+    trim_init(&state, newline_type, trailing_newline, strip);
+    out->len = 0;
+    trim_block(&state, in, in_len, out);
+    if(!check || !trim_changed(&state)) {
+        trim_finish(&state, out);
+    }
+    trim_lap(stats, TRIM_TRANSFORM, &mark);
+    trim_tally(stats, &state);
+    return state.first_change;
+}
+
+/* Returns up to 'len' bytes of 'file' from 'offset', taken from 'map' if it
+isn't NULL, or else read into 'buffer' without moving the position of 'file' on
+platforms with positioned reads. Sets 'len' to the number of bytes returned. */
+static const uint8_t* read_file_at(FILE* file, const uint8_t* map,
+                                   off_t offset, size_t* len,
+                                   struct TrimBuffer* buffer) {
+    if(map != NULL) {
+        return map + offset;
+    }
+    buffer->len = 0;
+    trim_reserve(buffer, *len);
+#ifdef _WIN32
+    fseeko(file, offset, SEEK_SET);
+    *len = fread(buffer->data, 1, *len, file);
+#else
+    size_t read_len = 0;
+    while(read_len < *len) {
+        ssize_t result = pread(
+            fileno(file), buffer->data + read_len, *len - read_len,
+            offset + read_len
+        );
+        if(result <= 0) {
+            break;
+        }
+        read_len += result;
+    }
+    *len = read_len;
+#endif // _WIN32
+    return buffer->data;
+}
+
+/* Returns true if the first 'len' bytes of 'file' contain a CR, reading them
+a block at a time as for read_file_at() */
+static bool find_cr(FILE* file, const uint8_t* map, off_t len,
+                    struct TrimBuffer* buffer, struct TrimStats* stats,
+                    uint64_t* mark) {
+    for(off_t offset = 0; offset < len;) {
+        size_t block_len = TrimBlockLen;
+        if((off_t)block_len > len - offset) {
+            block_len = len - offset;
+        }
+        const uint8_t* block = read_file_at(
+            file, map, offset, &block_len, buffer
+        );
+        trim_lap(stats, map != NULL ? TRIM_TRANSFORM : TRIM_READ, mark);
+        if(!block_len) {
+            break;
+        }
+        bool found = memchr(block, '\r', block_len) != NULL;
+        trim_lap(stats, TRIM_TRANSFORM, mark);
+        if(found) {
+            return true;
+        }
+        offset += block_len;
+    }
+    return false;
+}
+
+/* Counts the newlines of each type in the first 'len' bytes of 'file' into
+'state', without producing any output */
+static void count_newlines(FILE* file, const uint8_t* map, off_t len,
+                           struct TrimBuffer* buffer, struct TrimState* state,
+                           struct TrimStats* stats, uint64_t* mark) {
+    for(off_t offset = 0; offset < len;) {
+        size_t block_len = TrimBlockLen;
+        if((off_t)block_len > len - offset) {
+            block_len = len - offset;
+        }
+        const uint8_t* cur = read_file_at(
+            file, map, offset, &block_len, buffer
+        );
+        trim_lap(stats, map != NULL ? TRIM_TRANSFORM : TRIM_READ, mark);
+        if(!block_len) {
+            break;
+        }
+        offset += block_len;
+        const uint8_t* end = cur + block_len;
+        if(state->pending_cr) {
+            state->pending_cr = false;
+            if(*cur == '\n') {
+                ++state->num_crlf;
+                ++cur;
+            } else {
+                ++state->num_cr;
+            }
+        }
+        while(cur < end) {
+            const uint8_t* newline = scan_newline(cur, end);
+            if(newline == end) {
+                break;
+            } else if(*newline == '\n') {
+                ++state->num_lf;
+                cur = newline + 1;
+            } else if(newline + 1 == end) {
+                state->pending_cr = true;
+                break;
+            } else if(newline[1] == '\n') {
+                ++state->num_crlf;
+                cur = newline + 2;
+            } else {
+                ++state->num_cr;
+                cur = newline + 1;
+            }
+        }
+        trim_lap(stats, TRIM_TRANSFORM, mark);
+    }
+    if(state->pending_cr) {
+        state->pending_cr = false;
+        ++state->num_cr;
+    }
+}
+
+bool trim_tail(FILE* file, bool check, const uint8_t* map, size_t map_len,
+               struct Scratch* scratch, enum NewlineType newline_type,
+               bool trailing_newline, bool strip, struct TrimStats* stats,
+               bool* changed) {
+    if(strip || (newline_type != KEEP && newline_type != LF)) {
+        return false;
+    }
+    off_t len = map_len;
+    if(map == NULL) {
+#ifdef _WIN32
+        struct _stat64 file_stat;
+        if(_fstat64(_fileno(file), &file_stat) ||
+                !(file_stat.st_mode & _S_IFREG)) {
+            return false;
+        }
+#else
+        struct stat file_stat;
+        if(fstat(fileno(file), &file_stat) || !S_ISREG(file_stat.st_mode)) {
+            return false;
+        }
+#endif // _WIN32
+        len = file_stat.st_size;
+    }
+    struct TrimBuffer* buffer = &scratch->in;
+    struct TrimState state;
+    trim_init(&state, newline_type, trailing_newline, strip);
+    uint64_t mark = trim_lap_start(stats);
+
+    // Only newlines are counted for the statistics, as nothing else is read.
+    // With LF, any CR in the file means it has to be processed in full.
+    bool counted = stats != NULL;
+    bool full_read = counted || newline_type == LF;
+    if(counted) {
+        count_newlines(file, map, len, buffer, &state, stats, &mark);
+    }
+    if(newline_type == LF && (counted ? state.num_crlf || state.num_cr :
+            find_cr(file, map, len, buffer, stats, &mark))) {
+        // The position of 'file' may have been moved by reading it
+        fseeko(file, 0, SEEK_SET);
+        return false;
+    }
+
+    // Find the run of newlines at the end of the file, counting the CRLF
+    // pairs in it and noting its first two bytes
+    off_t run_start = len;
+    size_t pairs = 0;
+    uint8_t first = 0;
+    uint8_t second = 0;
+    uint64_t tail_read = 0;
+    bool in_run = trailing_newline;
+    while(in_run && run_start > 0) {
+        size_t block_len = TailBlockLen;
+        if((off_t)block_len > run_start) {
+            block_len = run_start;
+        }
+        off_t block_start = run_start - block_len;
+        const uint8_t* block = read_file_at(
+            file, map, block_start, &block_len, buffer
+        );
+        trim_lap(stats, map != NULL ? TRIM_TRANSFORM : TRIM_READ, &mark);
+        tail_read += block_len;
+        if(!block_len) {
+            break;
+        }
+        size_t i = block_len;
+        while(i > 0 && (block[i - 1] == '\r' || block[i - 1] == '\n')) {
+            --i;
+            if(block[i] == '\r' && first == '\n') {
+                ++pairs;
+            }
+            second = first;
+            first = block[i];
+        }
+        run_start = block_start + i;
+        in_run = i == 0;
+        trim_lap(stats, TRIM_TRANSFORM, &mark);
+    }
+
+    if(!trailing_newline) {
+        // Nothing in the file can change
+    } else if(run_start < len) {
+        // Keep only the first newline sequence of the run, as trim_finish()
+        // does. CRLF pairs can't straddle the newline kept, so every pair
+        // but the one kept is a newline removed.
+        size_t run_len = len - run_start;
+        size_t keep_len = 1;
+        if(run_len > 1 && first == '\r' && second == '\n') {
+            keep_len = 2;
+            --pairs;
+        }
+        if(run_len > keep_len) {
+            state.newlines_removed = run_len - keep_len - pairs;
+            state.first_change = run_start + keep_len;
+            if(!check) {
+                fflush(file);
+                if(ftruncate(fileno(file), state.first_change)) {
+                    scratch->error = errno;
+                }
+            }
+        }
+    } else {
+        // Append the most common newline, or LF if no CRs show the file
+        // could have any other kind
+        enum NewlineType append = LF;
+        if(newline_type == KEEP) {
+            if(!counted) {
+                full_read = true;
+                if(find_cr(file, map, len, buffer, stats, &mark)) {
+                    count_newlines(
+                        file, map, len, buffer, &state, stats, &mark
+                    );
+                }
+            }
+            append = trim_common_newline(&state);
+        }
+        const uint8_t* newline = (const uint8_t*)"\n";
+        size_t newline_len = 1;
+        if(append == CRLF) {
+            newline = (const uint8_t*)"\r\n";
+            newline_len = 2;
+        } else if(append == CR) {
+            newline = (const uint8_t*)"\r";
+        }
+        state.newline_added = true;
+        state.first_change = len;
+        if(!check) {
+            if(!write_file_at(file, newline, newline_len, len)) {
+                scratch->error = errno;
+            }
+            if(stats != NULL) {
+                stats->bytes_written += newline_len;
+            }
+        }
+    }
+    trim_lap(stats, TRIM_WRITE, &mark);
+    if(stats != NULL) {
+        stats->bytes_read += full_read ? (uint64_t)len : tail_read;
+        trim_tally(stats, &state);
+    }
+    *changed = trim_changed(&state);
+    return true;
+}
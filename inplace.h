@@ -0,0 +1,111 @@
+#ifndef NEWLINE_INPLACE_H
+#define NEWLINE_INPLACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "args.h"
+#include "tempfile.h"
+#include "trim.h"
+
+/* Resources kept by a thread processing files, so processing many files
+doesn't allocate buffers or create a temporary file for each one. Initialise
+with zeros, and release with scratch_free() once done.
+
+Engines rewriting a file carry on if part of it can't be written, setting
+'error', which the caller clears before each file. The file may then be left
+partly rewritten. */
+struct Scratch {
+    struct TrimBuffer in;    // Input read from the file
+    struct TrimBuffer out;   // Output not yet written
+    struct TempFile* temp;   // Emptied and reused whenever one's needed
+    int error;               // Value of errno if writing failed, else 0
+};
+
+/* Returns the temporary file of 'scratch', empty and with its position at the
+start, first creating it if needed. 'file' is the file it's needed for, and
+'name' its path. On Linux the temporary file is kept on the same filesystem as
+'file' where possible, and is replaced if it's on a different one. Returns
+NULL if a temporary file couldn't be created. */
+FILE* scratch_temp_file(struct Scratch* scratch, FILE* file,
+                        const arg_char* name);
+
+/* Empties the temporary file of 'scratch' once it's no longer needed, so it
+doesn't take up space until it's next used. */
+void scratch_release_temp_file(struct Scratch* scratch);
+
+/* Frees the buffers of 'scratch', and closes and deletes its temporary file */
+void scratch_free(struct Scratch* scratch);
+
+/* Processes 'file' in place, with the same options and result as trim_file().
+Requires that 'file' be opened for reading and writing in binary mode, and
+support seeking.
+
+If 'map' is not NULL, the file is read from the 'map_len' bytes at 'map',
+which must be a shared memory mapping of the whole file. Otherwise it is read
+from 'file' in blocks.
+
+Output is only written once it's known to differ from the input, and never
+past the end of the input read so far. If the output grows by more than a few
+MiB over the input (LF to CRLF conversion), the rest of the output is written
+to the temporary file of 'scratch' and copied into place once the input has
+been read. 'name' is the path of 'file'. Returns false if 'file' wasn't
+changed. Adds to 'stats' if it isn't NULL. */
+bool trim_in_place(FILE* file, const arg_char* name, const uint8_t* map,
+                   size_t map_len, struct Scratch* scratch,
+                   enum NewlineType newline_type, bool trailing_newline,
+                   bool strip, struct TrimStats* stats);
+
+/* Files smaller than this are read whole and processed in memory (64 KiB) */
+static const size_t SmallFileMax = 64*1024;
+
+/* Same as trim_in_place(), but reads the whole of 'file' into the buffers of
+'scratch' and processes it in memory, for files smaller than SmallFileMax. If
+the file is changed, everything from the first change onwards is written back
+with a single positioned write, and the file is truncated if it shrank. If
+'check' is true, nothing is written and 'file' may be opened read-only. */
+bool trim_small(FILE* file, bool check, struct Scratch* scratch,
+                enum NewlineType newline_type, bool trailing_newline,
+                bool strip, struct TrimStats* stats);
+
+/* Processes the 'in_len' bytes at 'in', the whole of a file, in memory as
+trim_small() does, leaving the output in 'out'. Returns the offset of the first
+change, or -1 if there are no changes. If 'check' is true and there are
+changes, the end of the file isn't processed, so 'out' is incomplete. */
+off_t trim_whole(const uint8_t* in, size_t in_len, struct TrimBuffer* out,
+                 bool check, enum NewlineType newline_type,
+                 bool trailing_newline, bool strip, struct TrimStats* stats);
+
+/* Same as trim_in_place(), but only looks at the end of 'file', for options
+which can only change its trailing newlines: when 'strip' is false and
+'newline_type' is KEEP, or LF for a file with no CRs. The run of newlines at
+the end of the file is found by reading backwards from the end, then truncated
+to its first newline, or a newline is appended if there isn't one. The rest of
+the file is only read to look for CRs with LF, to count newlines if 'stats'
+isn't NULL, or to pick the newline KEEP appends to a file containing a CR.
+
+If 'map' is not NULL, the file is read from the 'map_len' bytes at 'map', as
+for trim_in_place(). If 'check' is true, nothing is written and 'file' may be
+opened read-only. Sets 'changed' to whether or not the file was or would be
+changed. Returns false without writing anything if the file has to be
+processed in full instead: if the options can change more than the end of the
+file, or if 'file' isn't a regular file. */
+bool trim_tail(FILE* file, bool check, const uint8_t* map, size_t map_len,
+               struct Scratch* scratch, enum NewlineType newline_type,
+               bool trailing_newline, bool strip, struct TrimStats* stats,
+               bool* changed);
+
+/* Writes 'len' bytes of 'data' to 'file' at 'offset'. Positioned writes are
+used where available, avoiding a seek and a copy through the stdio buffer.
+Returns false with errno set if they couldn't all be written. */
+bool write_file_at(FILE* file, const uint8_t* data, size_t len, off_t offset);
+
+/* Copies the whole of 'source' into 'file' at 'offset'. On Linux the kernel
+copies the data where possible, otherwise it's copied through 'buffer'.
+Returns false with errno set if it couldn't all be read or written. */
+bool copy_file_into(FILE* file, off_t offset, FILE* source,
+                    struct TrimBuffer* buffer);
+
+#endif // NEWLINE_INPLACE_H
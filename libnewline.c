@@ -0,0 +1,71 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "libnewline.h"
+#include "trim.h"
+
+/* Returns a buffer viewing the output held by 'stream' in 'out', having
+dropped the output returned by the last call */
+static struct TrimBuffer held_buffer(struct NewlineStream* stream,
+                                     uint8_t* out, size_t out_capacity) {
+    struct TrimBuffer buffer = {
+        .data = out,
+        .len = stream->held,
+        .capacity = out_capacity
+    };
+    if(stream->returned) {
+        trim_release(&stream->state, &buffer, stream->returned);
+        stream->held = buffer.len;
+        stream->returned = 0;
+    }
+    return buffer;
+}
+
+void newline_init(struct NewlineStream* stream, enum NewlineType newline_type,
+                  bool trailing_newline, bool strip) {
+    trim_init(&stream->state, newline_type, trailing_newline, strip);
+    stream->held = 0;
+    stream->returned = 0;
+}
+
+size_t newline_push(struct NewlineStream* stream, const uint8_t* in,
+                    size_t in_len, uint8_t* out, size_t out_capacity,
+                    struct NewlineSpan* span) {
+    struct TrimBuffer buffer = held_buffer(stream, out, out_capacity);
+    // Only take as much input as trim_block() is sure to have room for, so it
+    // never needs to grow the buffer
+    size_t room = buffer.capacity - buffer.len;
+    size_t len = room > 2 ? (room - 2) / 2 : 0;
+    if(len > in_len) {
+        len = in_len;
+    }
+    if(len) {
+        trim_block(&stream->state, in, len, &buffer);
+    }
+    stream->held = buffer.len;
+    stream->returned = trim_decided(&stream->state, &buffer);
+    *span = (struct NewlineSpan){out, stream->returned};
+    return len;
+}
+
+bool newline_finish(struct NewlineStream* stream, uint8_t* out,
+                    size_t out_capacity, struct NewlineSpan* span) {
+    struct TrimBuffer buffer = held_buffer(stream, out, out_capacity);
+    if(buffer.capacity - buffer.len < NEWLINE_OUT_EXTRA) {
+        *span = (struct NewlineSpan){out, 0};
+        return false;
+    }
+    trim_finish(&stream->state, &buffer);
+    stream->held = buffer.len;
+    stream->returned = buffer.len;
+    *span = (struct NewlineSpan){out, buffer.len};
+    return true;
+}
+
+size_t newline_held(const struct NewlineStream* stream) {
+    return stream->held;
+}
+
+bool newline_changed(const struct NewlineStream* stream) {
+    return trim_changed(&stream->state);
+}
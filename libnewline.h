@@ -0,0 +1,140 @@
+#ifndef LIBNEWLINE_H
+#define LIBNEWLINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* libnewline converts newlines and strips trailing whitespace from data held
+in memory, exactly as the newline program does to files. It performs no I/O
+and never allocates memory: all of its state is in a NewlineStream owned by
+the caller, so any number of streams may be processed at once, from any
+threads.
+
+    struct NewlineStream stream;
+    struct NewlineSpan span;
+    newline_init(&stream, LF, true, true);
+    while(there's more input) {
+        size_t used = newline_push(&stream, in, in_len, out, out_capacity,
+                                   &span);
+        // Use the 'span.len' bytes at 'span.data', then carry on with the
+        // 'in_len - used' bytes of input not consumed yet
+    }
+    while(!newline_finish(&stream, out, out_capacity, &span)) {
+        // Grow 'out'
+    }
+    // Use the rest of the output, in 'span'
+*/
+
+#ifdef _WIN32
+    #define NEWLINE_API
+#else
+    #define NEWLINE_API __attribute__((visibility("default")))
+#endif // _WIN32
+
+enum NewlineType {
+    LF,
+    CRLF,
+    CR,
+    KEEP
+};
+
+/* State carried between the blocks of a file. The end of the output may still
+be undecided once a block has been processed: a run of newlines which may turn
+out to be excess trailing newlines, followed by a run of whitespace which may
+turn out to be trailing whitespace. These bytes stay at the end of the output
+until a later block or the end of the file decides what happens to them. */
+struct TrimState {
+    enum NewlineType newline_type;
+    bool trailing_newline;
+    bool strip;
+    bool pending_cr;            // Previous block ended with a CR
+    size_t pending_newline;     // Length of the undecided newline run
+    size_t pending_whitespace;  // Length of the undecided whitespace run
+    size_t num_lf;
+    size_t num_crlf;
+    size_t num_cr;
+    size_t stripped;            // Bytes of trailing whitespace removed
+    size_t newlines_removed;    // Excess trailing newlines removed
+    bool newline_added;         // Whether a trailing newline was added
+    off_t flushed;              // Bytes of output already released
+    off_t first_change;         // Output before this offset matches the
+                                // input, or -1 if there are no changes
+};
+
+/* A stream being processed. Its fields are private, and may only be used
+through the functions below. */
+struct NewlineStream {
+    struct TrimState state;
+    size_t held;        // Bytes of output at the start of the buffer
+    size_t returned;    // Bytes returned by the last call, dropped by the next
+};
+
+/* Output ready to be used, which stays valid until the stream's output buffer
+is next passed to a function below. */
+struct NewlineSpan {
+    const uint8_t* data;
+    size_t len;
+};
+
+/* Room needed in the output buffer beyond what newline_push() is given, for a
+CR held from the previous call followed by an LF converted to a CRLF (2 bytes),
+and by newline_finish() for a trailing newline (4 bytes) */
+#define NEWLINE_OUT_EXTRA 4
+
+/* Initialises 'stream' to process a new file.
+
+Newline sequences (LF, CRLF or CR) are converted to the newline sequence
+specified by 'newline_type'. If 'newline_type' is KEEP, newline sequences
+remain unchanged, even if they are inconsistent.
+
+If 'trailing_newline' is true, a single newline sequence specified by
+'newline_type' is added to the end of the file if one doesn't already exist,
+and multiple newline sequences at the end of the file are merged into one. If
+'newline_type' is KEEP, the type of newline sequence to add is the most common
+one in the file.
+
+If 'strip' is true, any whitespace before each newline sequence or the end of
+the file is removed. Whitespace is any sequence of spaces and tabs. */
+NEWLINE_API void newline_init(struct NewlineStream* stream,
+                              enum NewlineType newline_type,
+                              bool trailing_newline, bool strip);
+
+/* Processes up to 'in_len' bytes of input at 'in', returning the number of
+bytes consumed, and sets 'span' to the output which is now decided. Chunks may
+be of any size, and may split CRLF pairs or runs of whitespace.
+
+Output is written to the caller's buffer 'out' of 'out_capacity' bytes, and
+'span' always points to the start of it. Output which isn't decided yet stays
+in 'out' after 'span', so every call for a stream must be given a buffer
+starting with the same bytes as the one given to the last call: the same
+buffer, or a larger copy of it.
+
+Fewer than 'in_len' bytes are consumed if 'out' doesn't have room, as each
+byte of input may become two bytes of output. Room for twice the chunk length
+plus NEWLINE_OUT_EXTRA bytes after the undecided output is always enough to
+consume the whole chunk. If nothing is consumed and 'span' is empty,
+'out' is full of undecided output, such as a huge run of trailing whitespace,
+and must be grown before calling again. */
+NEWLINE_API size_t newline_push(struct NewlineStream* stream,
+                                const uint8_t* in, size_t in_len,
+                                uint8_t* out, size_t out_capacity,
+                                struct NewlineSpan* span);
+
+/* Processes the end of the file, setting 'span' to the rest of the output,
+after which the stream may only be initialised again. Returns false and sets
+'span' to be empty if 'out' needs to be grown, in which case it may be called
+again. */
+NEWLINE_API bool newline_finish(struct NewlineStream* stream, uint8_t* out,
+                                size_t out_capacity, struct NewlineSpan* span);
+
+/* Returns the number of bytes at the start of the output buffer of 'stream'
+which a grown buffer must start with: the output last set in 'span', which the
+next call drops, followed by the output still undecided. */
+NEWLINE_API size_t newline_held(const struct NewlineStream* stream);
+
+/* Returns true if the output differs from the input so far. */
+NEWLINE_API bool newline_changed(const struct NewlineStream* stream);
+
+#endif // LIBNEWLINE_H
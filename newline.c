@@ -6,131 +6,1075 @@
 #include <unistd.h>
 
 #ifdef _WIN32
+    #include <windows.h>
     #include <io.h>
     #include <fcntl.h>
     #include <share.h>
     #include <sys/stat.h>
-    #define delete(file) _wunlink(file)
-#else
-    #define delete(file) unlink(file)
+#endif // _WIN32
+
+#ifdef __linux__
+    #include <sys/mman.h>
+    #include "parallel.h"
+    #include "replace.h"
+    #include "uring.h"
+#endif // __linux__
+
+#ifndef _WIN32
+    #include <sys/stat.h>
+    #include "cache.h"
+    #include "walk.h"
 #endif // _WIN32
 
 #include "args.h"
+#include "binary.h"
+#include "inplace.h"
+#include "pipeline.h"
+#include "pool.h"
 #include "tempfile.h"
 #include "trim.h"
+#include "verify.h"
 
-static FILE* open_file(const arg_char* name) {
+/* Opens the file 'name' for reading, and for writing if 'write' is true, with
+a stdio buffer of 'buffer_len' bytes */
+static FILE* open_file(const arg_char* name, bool write, size_t buffer_len) {
 #ifdef _WIN32
     // Open the file allowing shared read, but not shared write
     int fd;
     _wsopen_s(
-        &fd, name, _O_RDWR | _O_BINARY | _O_NOINHERIT, _SH_DENYWR,
-        _S_IREAD | _S_IWRITE
+        &fd, name, (write ? _O_RDWR : _O_RDONLY) | _O_BINARY | _O_NOINHERIT,
+        _SH_DENYWR, _S_IREAD | _S_IWRITE
     );
     if(fd == -1) {
         return NULL;
     }
-    FILE* file = _fdopen(fd, "r+b");
+    FILE* file = _fdopen(fd, write ? "r+b" : "rb");
     if(file == NULL) {
         _close(fd);
         return NULL;
     }
-    setvbuf(file, NULL, _IOFBF, FileBufferLen);
+    setvbuf(file, NULL, _IOFBF, buffer_len);
     return file;
 #else
-    FILE* file = fopen(name, "r+b");
-    if(file != NULL) {
-        setvbuf(file, NULL, _IOFBF, FileBufferLen);
+    FILE* file = fopen(name, write ? "r+b" : "rb");
+    if(file == NULL) {
+        return NULL;
     }
+    // Directories can be opened for reading, but not processed
+    struct stat file_stat;
+    if(!fstat(fileno(file), &file_stat) && S_ISDIR(file_stat.st_mode)) {
+        fclose(file);
+        errno = EISDIR;
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, buffer_len);
     return file;
 #endif // _WIN32
 }
 
+#ifdef __linux__
+/* Files at least this large are memory mapped rather than read through stdio
+(1 MiB) */
+static const off_t MapThreshold = 1024*1024;
+
+/* Memory maps 'file' for reading if it's a regular file of at least
+MapThreshold bytes, setting 'len' to its length. Returns NULL if the file
+should be read through stdio instead, including when it can't be mapped. */
+static const uint8_t* map_file(FILE* file, size_t* len) {
+    struct stat file_stat;
+    if(fstat(fileno(file), &file_stat) || !S_ISREG(file_stat.st_mode) ||
+            file_stat.st_size < MapThreshold ||
+            (uintmax_t)file_stat.st_size > SIZE_MAX) {
+        return NULL;
+    }
+    void* data = mmap(
+        NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fileno(file), 0
+    );
+    if(data == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+    *len = file_stat.st_size;
+    return data;
+}
+#endif // __linux__
+
+/* What to do with the result of processing a file */
+enum Output {
+    OUTPUT_IN_PLACE,  // Rewrite the file
+    OUTPUT_CHECK,     // Only check whether or not there are changes
+    OUTPUT_STDOUT     // Write the result to stdout
+};
+
+/* Returns true if 'file' is a regular file smaller than 'len' bytes */
+static bool is_file_smaller(FILE* file, size_t len) {
 #ifdef _WIN32
-int wmain(int argc, wchar_t** argv) {
-    _setmode(_fileno(stdout), _O_U16TEXT);
-    _setmode(_fileno(stderr), _O_U16TEXT);
+    struct _stat64 file_stat;
+    return !_fstat64(_fileno(file), &file_stat) &&
+        (file_stat.st_mode & _S_IFREG) &&
+        file_stat.st_size < (__int64)len;
 #else
-int main(int argc, char** argv) {
-#endif
-    struct Arguments args = parse_args(argc, argv);
-    if(!args.valid) {
-        return EXIT_FAILURE;
+    struct stat file_stat;
+    return !fstat(fileno(file), &file_stat) && S_ISREG(file_stat.st_mode) &&
+        file_stat.st_size < (off_t)len;
+#endif // _WIN32
+}
+
+/* Processes the whole of 'file', or the 'map_len' bytes of it at 'map' if
+'map' isn't NULL, writing the result to 'out_file' unless it's NULL, as
+trim_stream() does. Files of at least PipelineMin bytes, and streams such as
+pipes, are read, processed and written at the same time through a pipeline with
+the buffers given in 'args'. */
+static bool stream_file(FILE* file, const uint8_t* map, size_t map_len,
+                        FILE* out_file, struct Scratch* scratch,
+                        const struct Arguments* args,
+                        struct TrimStats* stats) {
+    size_t depth = args->pipeline_depth;
+    if(map != NULL ? map_len < PipelineMin :
+            is_file_smaller(file, PipelineMin)) {
+        depth = 1;
     }
+    return trim_pipeline(
+        file, map, map_len, out_file, scratch, args->buffer_size, depth,
+        args->newline_type, args->trailing_newline, args->strip_whitespace,
+        stats
+    );
+}
 
-    bool success = true;
-    for(size_t i = 0; i < args.num_filenames; ++i) {
-        FILE* file = open_file(args.filenames[i]);
-        struct TempFile* temp_file = make_temp_file("newline_%.tmp");
-        if(file == NULL) {
-            arg_printerr(
-                arg_f arg_s(": ") arg_f arg_s(": ") arg_f,
-                argv[0], args.filenames[i], arg_strerror(errno)
+/* Processes 'file', named 'name', with the options given in 'args', using up
+to 'num_threads' threads for large files and the resources of 'scratch'.
+Unless 'output' is OUTPUT_IN_PLACE, 'file' may be opened read-only and needn't
+support seeking. Adds to 'stats' if it isn't NULL. Returns true if the file was
+or would be changed. */
+static bool process(FILE* file, const arg_char* name, enum Output output,
+                    size_t num_threads, struct Scratch* scratch,
+                    const struct Arguments* args, struct TrimStats* stats) {
+    if(output != OUTPUT_STDOUT && is_file_smaller(file, SmallFileMax)) {
+        return trim_small(
+            file, output == OUTPUT_CHECK, scratch, args->newline_type,
+            args->trailing_newline, args->strip_whitespace, stats
+        );
+    }
+
+    const uint8_t* map = NULL;
+    size_t map_len = 0;
+#ifdef __linux__
+    map = map_file(file, &map_len);
+#else
+    (void)num_threads;
+#endif // __linux__
+    FILE* out_file = output == OUTPUT_STDOUT ? stdout : NULL;
+    bool result;
+    if(output != OUTPUT_STDOUT && trim_tail(
+            file, output == OUTPUT_CHECK, map, map_len, scratch,
+            args->newline_type, args->trailing_newline,
+            args->strip_whitespace, stats, &result)) {
+        // Only the end of the file could change
+    } else
+#ifdef __linux__
+    if(map != NULL && output != OUTPUT_STDOUT && num_threads > 1 &&
+            map_len >= ParallelThreshold) {
+        result = trim_parallel(
+            output == OUTPUT_CHECK ? NULL : file, name, NULL, map, map_len,
+            num_threads, ParallelChunkMin, scratch, args->newline_type,
+            args->trailing_newline, args->strip_whitespace, stats
+        );
+    } else
+#endif // __linux__
+    if(output == OUTPUT_IN_PLACE) {
+        result = trim_in_place(
+            file, name, map, map_len, scratch, args->newline_type,
+            args->trailing_newline, args->strip_whitespace, stats
+        );
+    } else {
+        result = stream_file(
+            file, map, map_len, out_file, scratch, args, stats
+        );
+    }
+#ifdef __linux__
+    if(map != NULL) {
+        munmap((void*)map, map_len);
+    }
+#endif // __linux__
+    if(out_file != NULL) {
+        uint64_t mark = trim_lap_start(stats);
+        fflush(out_file);
+        trim_lap(stats, TRIM_WRITE, &mark);
+    }
+    return result;
+}
+
+#ifdef __linux__
+/* Processes the file 'name', open for reading as 'file', by writing the
+result to a new file which replaces it, using up to 'num_threads' threads for
+large files and the resources of 'scratch'. Falls back to rewriting the file in
+place if it can't be replaced. Returns true if the file was changed, setting
+'error' to the value of errno if it couldn't be. Adds to 'stats' if it isn't
+NULL. */
+static bool replace(const char* name, FILE* file, size_t num_threads,
+                    struct Scratch* scratch, const struct Arguments* args,
+                    struct TrimStats* stats, int* error) {
+    size_t map_len = 0;
+    const uint8_t* map = map_file(file, &map_len);
+    bool parallel = map != NULL && num_threads > 1 &&
+        map_len >= ParallelThreshold;
+
+    // Check for changes first, so unchanged files aren't copied. The check
+    // may stop early, so only its reading and time count if there are
+    // changes, which are counted when the result is written.
+    struct TrimStats check_stats = {0};
+    struct TrimStats* check_stats_ptr = stats != NULL ? &check_stats : NULL;
+    bool changed;
+    if(trim_tail(
+            file, true, map, map_len, scratch, args->newline_type,
+            args->trailing_newline, args->strip_whitespace, check_stats_ptr,
+            &changed)) {
+        // Only the end of the file could change
+    } else if(parallel) {
+        changed = trim_parallel(
+            NULL, name, NULL, map, map_len, num_threads, ParallelChunkMin,
+            scratch, args->newline_type, args->trailing_newline,
+            args->strip_whitespace, check_stats_ptr
+        );
+    } else {
+        changed = stream_file(
+            file, map, map_len, NULL, scratch, args, check_stats_ptr
+        );
+    }
+    if(stats != NULL && changed) {
+        stats->bytes_read += check_stats.bytes_read;
+        for(size_t i = 0; i < TRIM_NUM_PHASES; ++i) {
+            stats->phase_ns[i] += check_stats.phase_ns[i];
+        }
+    } else if(stats != NULL) {
+        trim_stats_add(stats, &check_stats);
+    }
+
+    uint64_t mark = trim_lap_start(stats);
+    struct Replacement* replacement = NULL;
+    if(changed) {
+        replacement = replace_begin(name, file);
+    }
+    if(replacement != NULL) {
+        trim_lap(stats, TRIM_WRITE, &mark);
+        FILE* out_file = replace_file(replacement);
+        if(parallel) {
+            trim_parallel(
+                NULL, name, out_file, map, map_len, num_threads,
+                ParallelChunkMin, scratch, args->newline_type,
+                args->trailing_newline, args->strip_whitespace, stats
             );
-            if(temp_file != NULL) {
-                fclose(temp_file->file);
-                delete(temp_file->filename);
-                free_temp_file(temp_file);
+        } else {
+            if(map == NULL) {
+                fseeko(file, 0, SEEK_SET);
             }
-            success = false;
-        } else if(temp_file == NULL) {
+            stream_file(file, map, map_len, out_file, scratch, args, stats);
+        }
+        mark = trim_lap_start(stats);
+        if(scratch->error) {
+            *error = scratch->error;
+            replace_abort(replacement);
+        } else if(!replace_commit(replacement)) {
+            *error = errno;
+        }
+        trim_lap(stats, TRIM_WRITE, &mark);
+    } else if(changed) {
+        trim_lap(stats, TRIM_WRITE, &mark);
+        FILE* in_place_file = open_file(name, true, args->buffer_size);
+        if(in_place_file != NULL) {
+            process(
+                in_place_file, name, OUTPUT_IN_PLACE, num_threads, scratch,
+                args, stats
+            );
+            fclose(in_place_file);
+        } else {
+            *error = errno;
+        }
+    }
+    if(map != NULL) {
+        munmap((void*)map, map_len);
+    }
+    return changed;
+}
+#endif // __linux__
+
+/* Returns true if 'name' refers to stdin */
+static bool is_stdin(const arg_char* name) {
+    return !arg_strcmp(name, arg_s("-"));
+}
+
+/* A single file to process, and the outcome of processing it */
+struct FileItem {
+    const arg_char* name;
+    bool owned;    // Whether or not 'name' was allocated for this item
+    bool changed;  // Whether or not the file was or would be changed
+    bool binary;   // Whether or not the file was skipped as binary data
+    int error;     // Value of errno if the file couldn't be processed, else 0
+    struct TrimStats stats;  // Statistics, if '--stats' was given
+#ifndef _WIN32
+    enum WalkText text;             // Text attribute from .gitattributes
+    bool cacheable;                 // Whether or not to record 'cache_entry'
+    struct CacheEntry cache_entry;  // Version of the file processed
+#endif // _WIN32
+};
+
+#ifdef __linux__
+/* Resources of a thread processing batches of files through io_uring */
+struct UringWorker {
+    bool opened;         // Whether or not opening 'ring' has been tried
+    struct Uring* ring;  // NULL if io_uring isn't available or stopped working
+    struct UringFile files[URING_BATCH_LEN];
+};
+
+/* Files processed together by a single thread */
+struct FileBatch {
+    struct FileItem* items[URING_BATCH_LEN];
+    size_t len;
+};
+#endif // __linux__
+
+/* Shared by every file processed by main() */
+struct Run {
+    const arg_char* prog_name;
+    const struct Arguments* args;
+    size_t file_threads;      // Threads each file may be split across
+    struct Scratch* scratch;  // Resources of each thread processing files
+#ifdef __linux__
+    struct UringWorker* uring;  // Same for batches of files, if batching
+#endif // __linux__
+    size_t next_arg;          // Index of the next filename in 'args'
+    bool stdout_output;       // Whether or not output of files goes to stdout
+#ifndef _WIN32
+    struct WalkOptions walk_options;
+    struct Walk* walk;        // Directory currently being walked
+    struct Cache* cache;      // Files known to need no changes, if any
+#endif // _WIN32
+    FILE* list;               // List of files to process, if any
+    struct TrimStats stats;   // Statistics of every file processed
+    size_t num_stats;         // Number of files in 'stats'
+    bool success;
+};
+
+static struct FileItem* make_item(const arg_char* name, bool owned,
+                                  int error) {
+    struct FileItem* item = malloc(sizeof(struct FileItem));
+    *item = (struct FileItem){
+        .name = name,
+        .owned = owned,
+        .changed = false,
+        .binary = false,
+        .error = error,
+        .stats = {0},
+#ifndef _WIN32
+        .text = WALK_TEXT_AUTO,
+        .cacheable = false
+#endif // _WIN32
+    };
+    return item;
+}
+
+/* Reads the next name from the list of files 'list', where names end with
+'delimiter' or the end of the file. Empty names are skipped. Returns the name,
+which the caller must free, or NULL once the list has been read. */
+static arg_char* read_list_name(FILE* list, char delimiter) {
+    char* name = NULL;
+    size_t len = 0;
+    size_t capacity = 0;
+    int c = getc(list);
+    while(c != EOF) {
+        if(c == delimiter) {
+            if(len) {
+                break;
+            }
+        } else {
+            if(len + 1 >= capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                name = realloc(name, capacity);
+            }
+            name[len++] = c;
+        }
+        c = getc(list);
+    }
+    if(!len) {
+        free(name);
+        return NULL;
+    }
+    name[len] = '\0';
+#ifdef _WIN32
+    // Names are read as UTF-8
+    int wide_len = MultiByteToWideChar(CP_UTF8, 0, name, -1, NULL, 0);
+    wchar_t* wide_name = malloc(wide_len * sizeof(wchar_t));
+    MultiByteToWideChar(CP_UTF8, 0, name, -1, wide_name, wide_len);
+    free(name);
+    return wide_name;
+#else
+    return name;
+#endif // _WIN32
+}
+
+/* Returns the next file to process, walking directories given in the
+arguments if processing recursively, or NULL once there are no files left.
+Files named in the arguments come first, followed by those in the list of
+files if one was given. Files found in directories, and names in the list, are
+returned as soon as they're found. */
+static void* next_file(void* context) {
+    struct Run* run = context;
+    while(true) {
+#ifndef _WIN32
+        if(run->walk != NULL) {
+            int error;
+            enum WalkText text;
+            char* name = walk_next(run->walk, &error, &text);
+            if(name != NULL) {
+                struct FileItem* item = make_item(name, true, error);
+                item->text = text;
+                return item;
+            }
+            walk_close(run->walk);
+            run->walk = NULL;
+        }
+#endif // _WIN32
+        const arg_char* name;
+        bool owned = false;
+        if(run->next_arg < run->args->num_filenames) {
+            name = run->args->filenames[run->next_arg++];
+        } else if(run->list != NULL) {
+            name = read_list_name(
+                run->list, run->args->files_from_nul ? '\0' : '\n'
+            );
+            if(name == NULL) {
+                return NULL;
+            }
+            owned = true;
+        } else {
+            return NULL;
+        }
+#ifndef _WIN32
+        struct stat file_stat;
+        if(run->args->recursive && !stat(name, &file_stat) &&
+                S_ISDIR(file_stat.st_mode)) {
+            run->walk = walk_open(name, &run->walk_options);
+            if(owned) {
+                free((arg_char*)name);
+            }
+            continue;
+        }
+#endif // _WIN32
+        return make_item(name, owned, 0);
+    }
+}
+
+/* Returns true if 'item', open as 'file', is to be skipped as binary data:
+if .gitattributes files say so, or otherwise if the start of the file looks
+like binary data, which is read into the buffers of 'scratch'. Files which
+can't be read without consuming them, such as pipes, are treated as text. */
+static bool is_binary(FILE* file, const struct FileItem* item,
+                      struct Scratch* scratch) {
+#ifndef _WIN32
+    if(item->text != WALK_TEXT_AUTO) {
+        return item->text == WALK_BINARY;
+    }
+#else
+    (void)item;
+#endif // _WIN32
+    trim_reserve(&scratch->in, BinarySampleLen);
+    return binary_file(file, scratch->in.data);
+}
+
+/* Copies the rest of 'file' to 'out_file' unchanged, through the buffers of
+'scratch' */
+static void copy_unchanged(FILE* file, FILE* out_file,
+                           struct Scratch* scratch) {
+    trim_reserve(&scratch->in, TrimBlockLen);
+    size_t read_len;
+    while((read_len = fread(scratch->in.data, 1, TrimBlockLen, file))) {
+        fwrite(scratch->in.data, 1, read_len, out_file);
+    }
+    fflush(out_file);
+}
+
+/* Processes a file. May be called from any thread, so only fills in the
+file's outcome rather than displaying it. */
+static void run_file(void* context, void* arg, size_t worker) {
+    struct Run* run = context;
+    struct FileItem* item = arg;
+    struct Scratch* scratch = &run->scratch[worker];
+    if(item->error) {
+        return;
+    }
+    scratch->error = 0;
+    // Names read from a list of files always name files, even '-'
+    bool from_stdin = !item->owned && is_stdin(item->name);
+    enum Output output = OUTPUT_IN_PLACE;
+    if(run->args->check) {
+        output = OUTPUT_CHECK;
+    } else if(run->args->to_stdout || from_stdin) {
+        output = OUTPUT_STDOUT;
+    }
+    struct TrimStats* stats = NULL;
+    if(run->args->stats != STATS_NONE) {
+        stats = &item->stats;
+    }
+    if(from_stdin) {
+        item->changed = process(
+            stdin, item->name, output, 1, scratch, run->args, stats
+        );
+        return;
+    }
+#ifndef _WIN32
+    // Files known to need no changes are skipped after a single stat()
+    struct stat file_stat;
+    bool use_cache = run->cache != NULL && output != OUTPUT_STDOUT;
+    if(use_cache && !stat(item->name, &file_stat)) {
+        cache_entry(&file_stat, &item->cache_entry);
+        if(cache_contains(run->cache, &item->cache_entry)) {
+            return;
+        }
+    }
+#endif // _WIN32
+    // Only rewriting the file in place needs write access
+    FILE* file = open_file(
+        item->name, output == OUTPUT_IN_PLACE && !run->args->atomic,
+        run->args->buffer_size
+    );
+    if(file == NULL) {
+        item->error = errno;
+        return;
+    }
+    if(run->args->binary != BINARY_PROCESS &&
+            is_binary(file, item, scratch)) {
+        // Binary files are passed through unchanged when writing to stdout,
+        // and never recorded in the cache, which doesn't know about them
+        item->binary = true;
+        if(output == OUTPUT_STDOUT) {
+            copy_unchanged(file, stdout, scratch);
+        }
+        fclose(file);
+        return;
+    }
+#ifndef _WIN32
+    // Record the version of the file actually read
+    if(use_cache && !fstat(fileno(file), &file_stat) &&
+            S_ISREG(file_stat.st_mode)) {
+        cache_entry(&file_stat, &item->cache_entry);
+        item->cacheable = true;
+    }
+#endif // _WIN32
+#ifdef DEBUG
+    // Debug builds check every engine against trim_file() using the file as
+    // it was before being processed
+    size_t original_len = 0;
+    uint8_t* original = verify_read(file, &original_len);
+#endif // DEBUG
+#ifdef __linux__
+    if(output == OUTPUT_IN_PLACE && run->args->atomic) {
+        item->changed = replace(
+            item->name, file, run->file_threads, scratch, run->args, stats,
+            &item->error
+        );
+    } else
+#endif // __linux__
+    {
+        item->changed = process(
+            file, item->name, output, run->file_threads, scratch, run->args,
+            stats
+        );
+    }
+#ifdef DEBUG
+    if(original != NULL) {
+        verify_engines(
+            item->name, original, original_len, run->args, item->changed
+        );
+        free(original);
+    }
+#endif // DEBUG
+    if(scratch->error && !item->error) {
+        // Writing failed part way through, so the file may be incomplete
+        item->error = scratch->error;
+    }
+    fclose(file);
+}
+
+/* Returns 'str' as a JSON string, in quotes, which the caller must free. */
+static arg_char* json_quote(const arg_char* str) {
+    static const char Hex[] = "0123456789abcdef";
+    arg_char* quoted = malloc((arg_strlen(str) * 6 + 3) * sizeof(arg_char));
+    arg_char* cur = quoted;
+    *cur++ = arg_s('"');
+    for(; *str != arg_s('\0'); ++str) {
+        if(*str == arg_s('"') || *str == arg_s('\\')) {
+            *cur++ = arg_s('\\');
+            *cur++ = *str;
+        } else if(!(*str & ~0x1F)) {
+            // Control characters
+            *cur++ = arg_s('\\');
+            *cur++ = arg_s('u');
+            *cur++ = arg_s('0');
+            *cur++ = arg_s('0');
+            *cur++ = Hex[*str >> 4];
+            *cur++ = Hex[*str & 0xF];
+        } else {
+            *cur++ = *str;
+        }
+    }
+    *cur++ = arg_s('"');
+    *cur = arg_s('\0');
+    return quoted;
+}
+
+/* Displays 'stats' in the format given by '--stats', for the file 'name', or
+for all 'num_files' files processed if 'name' is NULL. */
+static void print_stats(const struct Run* run, const arg_char* name,
+                        size_t num_files, const struct TrimStats* stats) {
+    // Keep stdout for the output of the files
+    FILE* out = run->stdout_output ? stderr : stdout;
+    unsigned long long read = stats->bytes_read;
+    unsigned long long written = stats->bytes_written;
+    unsigned long long lf = stats->num_lf;
+    unsigned long long crlf = stats->num_crlf;
+    unsigned long long cr = stats->num_cr;
+    unsigned long long stripped = stats->stripped;
+    unsigned long long removed = stats->newlines_removed;
+    unsigned long long added = stats->newlines_added;
+    unsigned long long read_ns = stats->phase_ns[TRIM_READ];
+    unsigned long long transform_ns = stats->phase_ns[TRIM_TRANSFORM];
+    unsigned long long write_ns = stats->phase_ns[TRIM_WRITE];
+    unsigned long long total_ns = read_ns + transform_ns + write_ns;
+    double mib_per_s = 0;
+    if(total_ns) {
+        mib_per_s = read / (1024.0 * 1024.0) / (total_ns / 1e9);
+    }
+
+    if(run->args->stats == STATS_JSON) {
+        arg_char* quoted = name != NULL ? json_quote(name) : NULL;
+        arg_fprint(
+            out,
+            arg_s("{\"file\": ") arg_f arg_s(", \"files\": %llu, ")
+            arg_s("\"bytes_read\": %llu, \"bytes_written\": %llu, ")
+            arg_s("\"lf\": %llu, \"crlf\": %llu, \"cr\": %llu, ")
+            arg_s("\"whitespace_stripped\": %llu, ")
+            arg_s("\"trailing_newlines_removed\": %llu, ")
+            arg_s("\"trailing_newlines_added\": %llu, ")
+            arg_s("\"read_ns\": %llu, \"transform_ns\": %llu, ")
+            arg_s("\"write_ns\": %llu, \"mib_per_s\": %.3f}"),
+            quoted != NULL ? quoted : arg_s("null"),
+            (unsigned long long)num_files, read, written, lf, crlf, cr,
+            stripped, removed, added, read_ns, transform_ns, write_ns,
+            mib_per_s
+        );
+        free(quoted);
+    } else {
+        if(name == NULL) {
+            arg_fprint(
+                out, arg_s("Total: %llu files"),
+                (unsigned long long)num_files
+            );
+        }
+        arg_fprint(
+            out,
+            arg_f arg_s(": read %llu bytes, wrote %llu bytes, %llu LF, ")
+            arg_s("%llu CRLF, %llu CR, stripped %llu bytes of whitespace, ")
+            arg_s("removed %llu and added %llu trailing newlines, ")
+            arg_s("%.3f ms reading, %.3f ms transforming, %.3f ms writing ")
+            arg_s("(%.1f MiB/s)"),
+            name != NULL ? name : arg_s("Total"), read, written, lf, crlf,
+            cr, stripped, removed, added, read_ns / 1e6, transform_ns / 1e6,
+            write_ns / 1e6, mib_per_s
+        );
+    }
+}
+
+/* Displays the outcome of processing a file. Always called in the same order
+the files were found in. */
+static void report_file(void* context, void* arg) {
+    struct Run* run = context;
+    struct FileItem* item = arg;
+    if(item->error) {
+        arg_printerr(
+            arg_f arg_s(": ") arg_f arg_s(": ") arg_f,
+            run->prog_name, item->name, arg_strerror(item->error)
+        );
+        run->success = false;
+    } else if(item->binary) {
+        if(run->args->binary == BINARY_REPORT) {
             arg_printerr(
-                arg_f arg_s(": ") arg_f arg_s(": Unable to create temporary ")
-                arg_s("file"), argv[0], args.filenames[i]
+                arg_f arg_s(": ") arg_f arg_s(": skipped binary file"),
+                run->prog_name, item->name
+            );
+            run->success = false;
+        } else if(run->args->verbose) {
+            arg_fprint(
+                run->stdout_output ? stderr : stdout,
+                arg_s("Skipped binary file ") arg_f, item->name
             );
-            fclose(file);
-            success = false;
+        }
+    } else if(run->args->check) {
+        // List files which would be changed
+        if(item->changed) {
+            arg_print(arg_f, item->name);
+            run->success = false;
+        } else if(run->args->verbose) {
+            arg_print(arg_s("No changes needed to ") arg_f, item->name);
+        }
+    } else if(run->args->verbose && run->stdout_output) {
+        // Keep stdout for the output of the files
+        if(item->changed) {
+            arg_printerr(arg_s("Processed ") arg_f, item->name);
+        } else {
+            arg_printerr(arg_s("No changes made to ") arg_f, item->name);
+        }
+    } else if(run->args->verbose) {
+        if(item->changed) {
+            arg_print(arg_s("Processed ") arg_f, item->name);
+        } else {
+            arg_print(arg_s("No changes made to ") arg_f, item->name);
+        }
+    }
+    if(run->args->stats != STATS_NONE && !item->error && !item->binary) {
+        print_stats(run, item->name, 1, &item->stats);
+        trim_stats_add(&run->stats, &item->stats);
+        ++run->num_stats;
+    }
+#ifndef _WIN32
+    if(item->cacheable && !item->error) {
+        cache_record(
+            run->cache, &item->cache_entry, item->name, !item->changed
+        );
+    }
+#endif // _WIN32
+    if(item->owned) {
+        free((arg_char*)item->name);
+    }
+    free(item);
+}
+
+#ifdef __linux__
+/* Returns the next batch of up to URING_BATCH_LEN files to process, found as
+next_file() finds them, or NULL once there are no files left */
+static void* next_batch(void* context) {
+    struct FileBatch* batch = malloc(sizeof(struct FileBatch));
+    batch->len = 0;
+    while(batch->len < URING_BATCH_LEN) {
+        struct FileItem* item = next_file(context);
+        if(item == NULL) {
+            break;
+        }
+        batch->items[batch->len++] = item;
+    }
+    if(!batch->len) {
+        free(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+/* Processes 'file', read whole through io_uring for 'item', leaving any
+changes to be written along with the rest of its batch. 'read_ns' is its share
+of the time spent reading the batch. */
+static void run_uring_file(struct Run* run, struct FileItem* item,
+                           struct UringFile* file, uint64_t read_ns) {
+    const struct Arguments* args = run->args;
+    struct TrimStats* stats = NULL;
+    if(args->stats != STATS_NONE) {
+        stats = &item->stats;
+    }
+    const uint8_t* in = file->in.data;
+    size_t in_len = file->in.len;
+    if(args->binary != BINARY_PROCESS) {
+        if(item->text != WALK_TEXT_AUTO) {
+            item->binary = item->text == WALK_BINARY;
         } else {
-            bool result = trim_file(
-                file, temp_file->file, args.newline_type,
-                args.trailing_newline, args.strip_whitespace
+            item->binary = in_len && binary_detect(
+                in, in_len < BinarySampleLen ? in_len : BinarySampleLen
             );
-            if(result) {
-                // Need to copy the temp file to original file. It would be
-                // faster to just rename() the temporary file to the original
-                // file, but this won't preserve file metadata such as
-                // permission bits or owners. ReplaceFile() does this on
-                // Windows, but an easy solution for Unix systems doesn't seem
-                // to exist.
-                fseeko(file, 0, SEEK_SET);
-                fseeko(temp_file->file, 0, SEEK_SET);
-                uint8_t* buffer = malloc(FileBufferLen);
-                size_t read_bytes = fread(
-                    buffer, 1, FileBufferLen, temp_file->file
+        }
+        if(item->binary) {
+            return;
+        }
+    }
+    if(run->cache != NULL && S_ISREG(file->stat.st_mode)) {
+        cache_entry(&file->stat, &item->cache_entry);
+        item->cacheable = true;
+    }
+    if(stats != NULL) {
+        stats->bytes_read += in_len;
+        stats->phase_ns[TRIM_READ] += read_ns;
+    }
+
+    off_t first_change = trim_whole(
+        in, in_len, &file->out, args->check, args->newline_type,
+        args->trailing_newline, args->strip_whitespace, stats
+    );
+    item->changed = first_change != -1;
+#ifdef DEBUG
+    verify_engines(item->name, in, in_len, args, item->changed);
+#endif // DEBUG
+    if(args->check || !item->changed) {
+        return;
+    }
+    file->write_data = file->out.data + first_change;
+    file->write_len = file->out.len - first_change;
+    file->write_offset = first_change;
+    if(file->out.len < in_len) {
+        uint64_t mark = trim_lap_start(stats);
+        if(ftruncate(file->fd, file->out.len)) {
+            // Leave the file as it was
+            item->error = errno;
+            file->write_len = 0;
+        }
+        trim_lap(stats, TRIM_WRITE, &mark);
+    }
+    if(stats != NULL) {
+        stats->bytes_written += file->write_len;
+    }
+}
+
+/* Processes a batch of files. Small files are opened and read together
+through the io_uring of the worker, then each is processed in memory, and
+their changes are written and the files closed together. Other files, and
+every file if io_uring isn't available, are processed one at a time by
+run_file(). The time spent on each step for the whole batch is shared between
+the files it was for. */
+static void run_batch(void* context, void* arg, size_t worker) {
+    struct Run* run = context;
+    struct FileBatch* batch = arg;
+    struct UringWorker* uring = &run->uring[worker];
+    if(!uring->opened) {
+        uring->ring = uring_open();
+        uring->opened = true;
+    }
+    bool one_at_a_time[URING_BATCH_LEN];
+    struct UringFile* files = uring->files;
+    for(size_t i = 0; i < batch->len; ++i) {
+        struct FileItem* item = batch->items[i];
+        // Names read from a list of files always name files, even '-'
+        one_at_a_time[i] = uring->ring == NULL ||
+            (!item->owned && is_stdin(item->name));
+        files[i].name = item->name;
+        files[i].write = !run->args->check;
+        files[i].skip = one_at_a_time[i] || item->error;
+        files[i].stat_done = false;
+        files[i].error = 0;
+        files[i].write_len = 0;
+    }
+
+    if(uring->ring != NULL) {
+        bool timed = run->args->stats != STATS_NONE;
+        // Files known to need no changes are skipped after a single stat(),
+        // which is quicker than io_uring's statx()
+        for(size_t i = 0; run->cache != NULL && i < batch->len; ++i) {
+            struct FileItem* item = batch->items[i];
+            if(!files[i].skip && !stat(item->name, &files[i].stat)) {
+                files[i].stat_done = true;
+                cache_entry(&files[i].stat, &item->cache_entry);
+                files[i].skip = cache_contains(
+                    run->cache, &item->cache_entry
                 );
-                while(read_bytes) {
-                    fwrite(buffer, 1, read_bytes, file);
-                    read_bytes = fread(
-                        buffer, 1, FileBufferLen, temp_file->file
-                    );
-                }
-                free(buffer);
+            }
+        }
+
+        uint64_t start = timed ? trim_clock() : 0;
+        bool working = uring_open_read(
+            uring->ring, files, batch->len, SmallFileMax
+        );
+        size_t num_read = 0;
+        for(size_t i = 0; i < batch->len; ++i) {
+            num_read += files[i].read;
+        }
+        uint64_t read_ns = timed && num_read ?
+            (trim_clock() - start) / num_read : 0;
 
-                off_t file_len = ftello(file);
-                fflush(file);
-                ftruncate(fileno(file), file_len);
+        bool written[URING_BATCH_LEN];
+        size_t num_written = 0;
+        for(size_t i = 0; i < batch->len; ++i) {
+            written[i] = false;
+            struct FileItem* item = batch->items[i];
+            if(files[i].skip) {
+                continue;
+            } else if(files[i].error) {
+                item->error = files[i].error;
+            } else if(working && files[i].read) {
+                run_uring_file(run, item, &files[i], read_ns);
+                written[i] = files[i].write_len > 0;
+                num_written += written[i];
+            } else {
+                // Large files, files which aren't regular files or changed
+                // size while being read, and every file left if the ring
+                // stopped working
+                if(files[i].fd != -1) {
+                    close(files[i].fd);
+                    files[i].fd = -1;
+                }
+                one_at_a_time[i] = true;
             }
-            if(args.verbose) {
-                if(result) {
-                    arg_print(
-                        arg_s("Processed ") arg_f,
-                        args.filenames[i]
-                    );
-                } else {
-                    arg_print(
-                        arg_s("No changes made to ") arg_f,
-                        args.filenames[i]
-                    );
+        }
+
+        if(working) {
+            start = timed ? trim_clock() : 0;
+            working = uring_write_close(uring->ring, files, batch->len);
+            uint64_t write_ns = timed && num_written ?
+                (trim_clock() - start) / num_written : 0;
+            for(size_t i = 0; i < batch->len; ++i) {
+                if(written[i] && files[i].error && !batch->items[i]->error) {
+                    batch->items[i]->error = files[i].error;
+                }
+                if(timed && written[i]) {
+                    batch->items[i]->stats.phase_ns[TRIM_WRITE] += write_ns;
                 }
             }
-            fclose(file);
-            fclose(temp_file->file);
-            delete(temp_file->filename);
-            free_temp_file(temp_file);
+        }
+        if(!working) {
+            // Later batches are processed one file at a time
+            uring_close(uring->ring);
+            uring->ring = NULL;
+        }
+    }
+
+    for(size_t i = 0; i < batch->len; ++i) {
+        if(one_at_a_time[i]) {
+            run_file(context, batch->items[i], worker);
+        }
+    }
+}
+
+/* Displays the outcome of processing each file of a batch, in order */
+static void report_batch(void* context, void* arg) {
+    struct FileBatch* batch = arg;
+    for(size_t i = 0; i < batch->len; ++i) {
+        report_file(context, batch->items[i]);
+    }
+    free(batch);
+}
+#endif // __linux__
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t** argv) {
+    _setmode(_fileno(stdout), _O_U16TEXT);
+    _setmode(_fileno(stderr), _O_U16TEXT);
+#else
+int main(int argc, char** argv) {
+#endif
+    struct Arguments args = parse_args(argc, argv);
+    if(!args.valid) {
+        return EXIT_FAILURE;
+    }
+    if(args.num_filenames == 0 && args.files_from == NULL) {
+        // '--help' or '--version' was given
+        return EXIT_SUCCESS;
+    }
+
+    // Share threads between files first, giving any left over to large
+    // files which can be split into chunks
+    size_t jobs = args.jobs ? args.jobs : pool_default_threads();
+    size_t file_jobs = jobs;
+    if(!args.recursive && args.files_from == NULL &&
+            args.num_filenames < jobs) {
+        file_jobs = args.num_filenames;
+    }
+
+    // Files written to stdout need to be processed one at a time to keep
+    // their output in order
+    bool stdout_output = args.to_stdout;
+    for(size_t i = 0; i < args.num_filenames && !args.check; ++i) {
+        if(is_stdin(args.filenames[i])) {
+            stdout_output = true;
+        }
+    }
+    if(stdout_output && !args.check) {
+        file_jobs = 1;
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif // _WIN32
+    }
+    struct Run run = {
+        .prog_name = argv[0],
+        .args = &args,
+        .file_threads = jobs / file_jobs,
+        .scratch = calloc(file_jobs, sizeof(struct Scratch)),
+#ifdef __linux__
+        .uring = NULL,
+#endif // __linux__
+        .next_arg = 0,
+        .stdout_output = stdout_output && !args.check,
+#ifndef _WIN32
+        .walk_options = {
+            .includes = args.includes,
+            .num_includes = args.num_includes,
+            .excludes = args.excludes,
+            .num_excludes = args.num_excludes,
+            .gitignore = args.gitignore,
+            .gitattributes = args.gitattributes
+        },
+        .walk = NULL,
+        .cache = NULL,
+#endif // _WIN32
+        .list = NULL,
+        .stats = {0},
+        .num_stats = 0,
+        .success = true
+    };
+    if(args.files_from != NULL) {
+        run.list = is_stdin(args.files_from) ?
+            stdin : open_file(args.files_from, false, args.buffer_size);
+        if(run.list == NULL) {
+            arg_printerr(
+                arg_f arg_s(": ") arg_f arg_s(": ") arg_f,
+                argv[0], args.files_from, arg_strerror(errno)
+            );
+            free(run.scratch);
+            free_args(&args);
+            return EXIT_FAILURE;
+        }
+    }
+#ifndef _WIN32
+    if(args.cache != NULL) {
+        run.cache = cache_open(args.cache, &args);
+    }
+#endif // _WIN32
+#ifdef __linux__
+    // Small files are opened, read, written and closed in batches when there
+    // may be many of them
+    if(args.io_uring && !run.stdout_output && (!args.atomic || args.check) &&
+            (args.recursive || args.files_from != NULL)) {
+        run.uring = calloc(file_jobs, sizeof(struct UringWorker));
+        pool_run(file_jobs, next_batch, run_batch, report_batch, &run);
+    } else
+#endif // __linux__
+    pool_run(file_jobs, next_file, run_file, report_file, &run);
+    if(args.stats != STATS_NONE) {
+        print_stats(&run, NULL, run.num_stats, &run.stats);
+    }
+#ifndef _WIN32
+    if(run.cache != NULL && !cache_close(run.cache)) {
+        arg_printerr(
+            arg_f arg_s(": ") arg_f arg_s(": ") arg_f,
+            argv[0], args.cache, arg_strerror(errno)
+        );
+        run.success = false;
+    }
+#endif // _WIN32
+    if(run.list != NULL && run.list != stdin) {
+        fclose(run.list);
+    }
+    for(size_t i = 0; i < file_jobs; ++i) {
+        scratch_free(&run.scratch[i]);
+    }
+#ifdef __linux__
+    for(size_t i = 0; run.uring != NULL && i < file_jobs; ++i) {
+        if(run.uring[i].ring != NULL) {
+            uring_close(run.uring[i].ring);
+        }
+        for(size_t j = 0; j < URING_BATCH_LEN; ++j) {
+            free(run.uring[i].files[j].in.data);
+            free(run.uring[i].files[j].out.data);
         }
     }
+    free(run.uring);
+#endif // __linux__
+    free(run.scratch);
     free_args(&args);
-    if(!success) {
+    if(!run.success) {
         return EXIT_FAILURE;
     }
     return EXIT_SUCCESS;
@@ -0,0 +1,279 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "args.h"
+#include "inplace.h"
+#include "parallel.h"
+#include "pool.h"
+#include "tempfile.h"
+#include "trim.h"
+
+struct Chunk {
+    const uint8_t* in;
+    size_t in_len;
+    struct TrimState state;  // State after the first pass
+    struct TrimBuffer out;   // Undecided output of the last chunk
+    off_t out_offset;        // Offset of the chunk's output in the file
+    int error;               // Value of errno if writing failed, else 0
+};
+
+struct Parallel {
+    struct Chunk* chunks;
+    size_t num_chunks;
+    size_t next_chunk;       // Next chunk to be given to a thread
+    enum NewlineType newline_type;
+    bool trailing_newline;
+    bool strip;
+    size_t num_lf;           // Newline counts for the whole file
+    size_t num_crlf;
+    size_t num_cr;
+    off_t first_change;      // Offset of the first change in the whole file
+    off_t write_from;        // Output before this offset isn't written
+    FILE* temp_file;         // Output from 'write_from' onwards
+};
+
+/* Releases the decided output of 'chunk', first writing it to 'temp_file' if
+it isn't NULL, skipping any output before 'write_from'. */
+static void release_chunk(const struct Parallel* parallel, struct Chunk* chunk,
+                          FILE* temp_file) {
+    size_t decided = trim_decided(&chunk->state, &chunk->out);
+    if(temp_file != NULL) {
+        off_t out_offset = chunk->out_offset + chunk->state.flushed;
+        size_t skip = 0;
+        if(out_offset < parallel->write_from) {
+            skip = parallel->write_from - out_offset;
+            if(skip > decided) {
+                skip = decided;
+            }
+        }
+        if(!write_file_at(
+                temp_file, chunk->out.data + skip, decided - skip,
+                out_offset + skip - parallel->write_from)) {
+            chunk->error = errno;
+        }
+    }
+    trim_release(&chunk->state, &chunk->out, decided);
+}
+
+/* Runs the engine over 'chunk', finishing the file if 'finish' is true. Any
+undecided output is left in the chunk's buffer, which the caller frees. Chunks
+other than the last always end in decided output. */
+static void trim_chunk(const struct Parallel* parallel, struct Chunk* chunk,
+                       bool finish, FILE* temp_file) {
+    trim_init(
+        &chunk->state, parallel->newline_type, parallel->trailing_newline,
+        parallel->strip
+    );
+    chunk->out = (struct TrimBuffer){.data = NULL, .len = 0, .capacity = 0};
+    for(size_t offset = 0; offset < chunk->in_len; offset += TrimBlockLen) {
+        size_t block_len = chunk->in_len - offset;
+        if(block_len > TrimBlockLen) {
+            block_len = TrimBlockLen;
+        }
+        trim_block(
+            &chunk->state, chunk->in + offset, block_len, &chunk->out
+        );
+        release_chunk(parallel, chunk, temp_file);
+    }
+    if(finish) {
+        // The trailing newline added by KEEP depends on the whole file
+        chunk->state.num_lf = parallel->num_lf;
+        chunk->state.num_crlf = parallel->num_crlf;
+        chunk->state.num_cr = parallel->num_cr;
+        trim_finish(&chunk->state, &chunk->out);
+        release_chunk(parallel, chunk, temp_file);
+    }
+}
+
+static void* next_chunk(void* context) {
+    struct Parallel* parallel = context;
+    if(parallel->next_chunk == parallel->num_chunks) {
+        return NULL;
+    }
+    return &parallel->chunks[parallel->next_chunk++];
+}
+
+static void measure_chunk(void* context, void* item, size_t worker) {
+    (void)worker;
+    struct Parallel* parallel = context;
+    struct Chunk* chunk = item;
+    trim_chunk(parallel, chunk, false, NULL);
+    if(chunk != &parallel->chunks[parallel->num_chunks - 1]) {
+        free(chunk->out.data);
+    }
+}
+
+static void write_chunk(void* context, void* item, size_t worker) {
+    (void)worker;
+    struct Parallel* parallel = context;
+    struct Chunk* chunk = item;
+    size_t index = chunk - parallel->chunks;
+    bool last = index + 1 == parallel->num_chunks;
+    // Chunks entirely before 'write_from' have nothing to write
+    if(last || parallel->chunks[index + 1].out_offset >
+            parallel->write_from) {
+        trim_chunk(parallel, chunk, last, parallel->temp_file);
+        free(chunk->out.data);
+    }
+}
+
+/* Returns the value of errno for the first chunk whose output couldn't be
+written, or 0 if all of it was */
+static int chunks_error(const struct Parallel* parallel) {
+    for(size_t i = 0; i < parallel->num_chunks; ++i) {
+        if(parallel->chunks[i].error) {
+            return parallel->chunks[i].error;
+        }
+    }
+    return 0;
+}
+
+/* Returns true if a chunk may end just after 'byte' */
+static bool is_split_point(uint8_t byte) {
+    return byte != '\r' && byte != '\n' && byte != ' ' && byte != '\t';
+}
+
+bool trim_parallel(FILE* file, const char* name, FILE* out_file,
+                   const uint8_t* map, size_t map_len, size_t num_threads,
+                   size_t chunk_min, struct Scratch* scratch,
+                   enum NewlineType newline_type, bool trailing_newline,
+                   bool strip, struct TrimStats* stats) {
+    struct Parallel parallel = {
+        .chunks = NULL,
+        .num_chunks = 0,
+        .next_chunk = 0,
+        .newline_type = newline_type,
+        .trailing_newline = trailing_newline,
+        .strip = strip,
+        .num_lf = 0,
+        .num_crlf = 0,
+        .num_cr = 0,
+        .first_change = -1,
+        .write_from = 0,
+        .temp_file = NULL
+    };
+
+    // Split the file into chunks
+    size_t chunk_len = map_len / num_threads;
+    if(chunk_len < chunk_min) {
+        chunk_len = chunk_min;
+    }
+    parallel.chunks = malloc(
+        (map_len / chunk_len + 1) * sizeof(struct Chunk)
+    );
+    size_t offset = 0;
+    do {
+        size_t end = map_len;
+        if(map_len - offset >= 2 * chunk_len) {
+            end = offset + chunk_len;
+            while(end < map_len && !is_split_point(map[end - 1])) {
+                ++end;
+            }
+        }
+        parallel.chunks[parallel.num_chunks++] = (struct Chunk){
+            .in = map + offset,
+            .in_len = end - offset
+        };
+        offset = end;
+    } while(offset < map_len);
+
+    // First pass, measuring the output of each chunk
+    uint64_t mark = trim_lap_start(stats);
+    pool_run(num_threads, next_chunk, measure_chunk, NULL, &parallel);
+    struct Chunk* last = &parallel.chunks[parallel.num_chunks - 1];
+    for(size_t i = 0; i < parallel.num_chunks; ++i) {
+        parallel.num_lf += parallel.chunks[i].state.num_lf;
+        parallel.num_crlf += parallel.chunks[i].state.num_crlf;
+        parallel.num_cr += parallel.chunks[i].state.num_cr;
+    }
+    last->state.num_lf = parallel.num_lf;
+    last->state.num_crlf = parallel.num_crlf;
+    last->state.num_cr = parallel.num_cr;
+    trim_finish(&last->state, &last->out);
+    size_t last_tail_len = last->out.len;
+    free(last->out.data);
+
+    // Find where each chunk's output starts from the lengths before it
+    off_t out_len = 0;
+    for(size_t i = 0; i < parallel.num_chunks; ++i) {
+        struct Chunk* chunk = &parallel.chunks[i];
+        chunk->out_offset = out_len;
+        if(parallel.first_change == -1 && trim_changed(&chunk->state)) {
+            parallel.first_change =
+                chunk->out_offset + chunk->state.first_change;
+        }
+        out_len += chunk->state.flushed;
+    }
+    out_len += last_tail_len;
+    trim_lap(stats, TRIM_TRANSFORM, &mark);
+
+    bool changed = parallel.first_change != -1;
+    bool fell_back = false;
+    off_t written = 0;
+    if(changed && out_file != NULL) {
+        // Second pass, writing the whole output
+        parallel.temp_file = out_file;
+        parallel.next_chunk = 0;
+        pool_run(num_threads, next_chunk, write_chunk, NULL, &parallel);
+        if(chunks_error(&parallel)) {
+            scratch->error = chunks_error(&parallel);
+        }
+        written = out_len;
+    } else if(changed && file != NULL) {
+        // Second pass, writing the output of each chunk from the first change
+        // onwards into a temporary file
+        FILE* temp_file = scratch_temp_file(scratch, file, name);
+        if(temp_file != NULL) {
+            parallel.write_from = parallel.first_change;
+            parallel.temp_file = temp_file;
+            parallel.next_chunk = 0;
+            pool_run(num_threads, next_chunk, write_chunk, NULL, &parallel);
+            // The file is left as it was if the output couldn't all be
+            // written to the temporary file
+            int error = chunks_error(&parallel);
+            if(!error && !copy_file_into(
+                    file, parallel.first_change, temp_file, &scratch->in)) {
+                error = errno;
+            }
+            fflush(file);
+            if(!error && out_len < (off_t)map_len &&
+                    ftruncate(fileno(file), out_len)) {
+                error = errno;
+            }
+            if(error) {
+                scratch->error = error;
+            }
+            scratch_release_temp_file(scratch);
+            written = out_len - parallel.first_change;
+        } else {
+            // Fall back to a single thread without a temporary file, which
+            // counts everything again
+            changed = trim_in_place(
+                file, name, map, map_len, scratch, newline_type,
+                trailing_newline, strip, stats
+            );
+            fell_back = true;
+        }
+    }
+    trim_lap(stats, TRIM_WRITE, &mark);
+    if(stats != NULL && !fell_back) {
+        // The last chunk was given the newline counts of the whole file, and
+        // holds the changes made at the end of it
+        stats->bytes_read += map_len;
+        stats->bytes_written += written;
+        stats->num_lf += parallel.num_lf;
+        stats->num_crlf += parallel.num_crlf;
+        stats->num_cr += parallel.num_cr;
+        for(size_t i = 0; i < parallel.num_chunks; ++i) {
+            stats->stripped += parallel.chunks[i].state.stripped;
+        }
+        stats->newlines_removed += last->state.newlines_removed;
+        stats->newlines_added += last->state.newline_added;
+    }
+    free(parallel.chunks);
+    return changed;
+}
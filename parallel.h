@@ -0,0 +1,47 @@
+#ifndef NEWLINE_PARALLEL_H
+#define NEWLINE_PARALLEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "args.h"
+#include "inplace.h"
+
+/* Files at least this large are split into chunks and processed by several
+threads at once (64 MiB) */
+static const size_t ParallelThreshold = 64*1024*1024;
+
+/* Smallest chunk worth giving its own thread (16 MiB) */
+static const size_t ParallelChunkMin = 16*1024*1024;
+
+/* Same as trim_in_place(), but splits the 'map_len' bytes at 'map' into
+chunks which are processed by up to 'num_threads' threads. 'map' must be a
+shared memory mapping of the whole of 'file'. Chunks are at least 'chunk_min'
+bytes long, which should be ParallelChunkMin other than in tests, where
+chunks of a few bytes split even small inputs.
+
+Chunks are split just after a character which isn't a CR, LF, space or tab,
+where no CRLF pair, whitespace run or newline run can span the split. Each
+chunk is processed twice: once to find the length of its output and the
+newline counts needed by KEEP, and once more to write its output into a
+temporary file at the offset given by the sum of the lengths before it. The
+temporary file is that of 'scratch', kept on the same filesystem as 'file',
+whose path is 'name', and the changed part of it is copied into 'file'.
+
+If 'out_file' isn't NULL, the whole of the output is written to it instead,
+leaving 'file' unchanged. If both are NULL, only the first pass is made, to
+check whether or not the file would be changed. Returns false if the file
+wasn't or wouldn't be changed, in which case nothing is written. If the output
+can't all be written to the temporary file, 'file' is left as it was, and the
+'error' of 'scratch' is set, as it is if it can't be copied into 'file'.
+
+Adds to 'stats' if it isn't NULL, timing the first pass as TRIM_TRANSFORM and
+the second pass, which writes the output, as TRIM_WRITE. */
+bool trim_parallel(FILE* file, const char* name, FILE* out_file,
+                   const uint8_t* map, size_t map_len, size_t num_threads,
+                   size_t chunk_min, struct Scratch* scratch,
+                   enum NewlineType newline_type, bool trailing_newline,
+                   bool strip, struct TrimStats* stats);
+
+#endif // NEWLINE_PARALLEL_H
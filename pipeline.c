@@ -0,0 +1,321 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+    #include <pthread.h>
+#endif // _WIN32
+#include "args.h"
+#include "inplace.h"
+#include "pipeline.h"
+#include "trim.h"
+
+#ifndef _WIN32
+/* Distance between the bytes touched to fault in a mapped block, no larger
+than a page on any platform (4 KiB) */
+static const size_t PipelinePageLen = 4*1024;
+
+/* A buffer passed between the stages of a pipeline */
+struct PipelineBlock {
+    const uint8_t* data;       // Input, in 'buffer' unless it's mapped
+    size_t len;                // Length of the input, 0 at the end of it
+    struct TrimBuffer buffer;
+};
+
+/* Blocks waiting to be taken by a stage, oldest first */
+struct PipelineQueue {
+    struct PipelineBlock** blocks;  // Ring of 'depth' blocks
+    size_t head;
+    size_t count;
+};
+
+struct Pipeline {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;       // Signalled whenever anything below changes
+    bool stop;                 // Set once the reader should stop
+    bool finished;             // Set once the last output has been queued
+    size_t depth;
+    struct PipelineQueue free_in;   // Input buffers ready to be filled
+    struct PipelineQueue full_in;   // Input waiting to be processed
+    struct PipelineQueue free_out;  // Output buffers ready to be filled
+    struct PipelineQueue full_out;  // Output waiting to be written
+    FILE* in_file;
+    const uint8_t* map;
+    size_t map_len;
+    FILE* out_file;
+    size_t buffer_len;
+    bool timed;                // Whether or not to time the threads
+    uint64_t read_ns;          // Time spent reading by the reader thread
+    uint64_t write_ns;         // Time spent writing by the writer thread
+};
+
+/* Appends 'block' to 'queue', waking any stage waiting for it */
+static void queue_put(struct Pipeline* pipeline, struct PipelineQueue* queue,
+                      struct PipelineBlock* block) {
+    pthread_mutex_lock(&pipeline->lock);
+    queue->blocks[(queue->head + queue->count) % pipeline->depth] = block;
+    ++queue->count;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+/* Takes the oldest block from 'queue', waiting for one if it's empty. Returns
+NULL once 'queue' is empty and 'until' is true, or never if 'until' is NULL. */
+static struct PipelineBlock* queue_take(struct Pipeline* pipeline,
+                                        struct PipelineQueue* queue,
+                                        const bool* until) {
+    pthread_mutex_lock(&pipeline->lock);
+    while(!queue->count && (until == NULL || !*until)) {
+        pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+    }
+    struct PipelineBlock* block = NULL;
+    if(queue->count) {
+        block = queue->blocks[queue->head];
+        queue->head = (queue->head + 1) % pipeline->depth;
+        --queue->count;
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return block;
+}
+
+/* Sets 'flag' and wakes every stage so they can see it */
+static void pipeline_signal(struct Pipeline* pipeline, bool* flag) {
+    pthread_mutex_lock(&pipeline->lock);
+    *flag = true;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static void* pipeline_reader(void* arg) {
+    struct Pipeline* pipeline = arg;
+    size_t offset = 0;
+    while(true) {
+        struct PipelineBlock* block = queue_take(
+            pipeline, &pipeline->free_in, &pipeline->stop
+        );
+        if(block == NULL) {
+            break;
+        }
+        uint64_t start = pipeline->timed ? trim_clock() : 0;
+        if(pipeline->map != NULL) {
+            block->data = pipeline->map + offset;
+            block->len = pipeline->map_len - offset;
+            if(block->len > pipeline->buffer_len) {
+                block->len = pipeline->buffer_len;
+            }
+            // Fault the block in now, rather than while it's processed
+            const volatile uint8_t* page = block->data;
+            for(size_t i = 0; i < block->len; i += PipelinePageLen) {
+                (void)page[i];
+            }
+        } else {
+            block->data = block->buffer.data;
+            block->len = fread(
+                block->buffer.data, 1, pipeline->buffer_len,
+                pipeline->in_file
+            );
+        }
+        offset += block->len;
+        if(pipeline->timed) {
+            pipeline->read_ns += trim_clock() - start;
+        }
+        queue_put(pipeline, &pipeline->full_in, block);
+        if(!block->len) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void* pipeline_writer(void* arg) {
+    struct Pipeline* pipeline = arg;
+    while(true) {
+        struct PipelineBlock* block = queue_take(
+            pipeline, &pipeline->full_out, &pipeline->finished
+        );
+        if(block == NULL) {
+            break;
+        }
+        uint64_t start = pipeline->timed ? trim_clock() : 0;
+        fwrite(block->buffer.data, 1, block->buffer.len, pipeline->out_file);
+        if(pipeline->timed) {
+            pipeline->write_ns += trim_clock() - start;
+        }
+        queue_put(pipeline, &pipeline->free_out, block);
+    }
+    return NULL;
+}
+
+/* Runs the pipeline described by trim_pipeline(), setting 'changed' to its
+result. Returns false without processing anything if its threads couldn't be
+started. */
+static bool run_pipeline(FILE* in_file, const uint8_t* map, size_t map_len,
+                         FILE* out_file, struct Scratch* scratch,
+                         size_t buffer_len, size_t depth,
+                         enum NewlineType newline_type, bool trailing_newline,
+                         bool strip, struct TrimStats* stats, bool* changed) {
+    struct PipelineBlock* blocks = calloc(
+        2 * depth, sizeof(struct PipelineBlock)
+    );
+    struct PipelineBlock** rings = malloc(
+        4 * depth * sizeof(struct PipelineBlock*)
+    );
+    struct Pipeline pipeline = {
+        .stop = false,
+        .finished = false,
+        .depth = depth,
+        .free_in = {rings, 0, depth},
+        .full_in = {rings + depth, 0, 0},
+        .free_out = {rings + 2 * depth, 0, depth},
+        .full_out = {rings + 3 * depth, 0, 0},
+        .in_file = in_file,
+        .map = map,
+        .map_len = map_len,
+        .out_file = out_file,
+        .buffer_len = buffer_len,
+        .timed = stats != NULL,
+        .read_ns = 0,
+        .write_ns = 0
+    };
+    for(size_t i = 0; i < depth; ++i) {
+        if(map == NULL) {
+            trim_reserve(&blocks[i].buffer, buffer_len);
+        }
+        pipeline.free_in.blocks[i] = &blocks[i];
+        pipeline.free_out.blocks[i] = &blocks[depth + i];
+    }
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.cond, NULL);
+
+    // Without an output file there's nothing for a writer thread to do
+    pthread_t reader;
+    pthread_t writer;
+    bool started = out_file == NULL ||
+        !pthread_create(&writer, NULL, pipeline_writer, &pipeline);
+    if(started && pthread_create(&reader, NULL, pipeline_reader, &pipeline)) {
+        started = false;
+        if(out_file != NULL) {
+            pipeline_signal(&pipeline, &pipeline.finished);
+            pthread_join(writer, NULL);
+        }
+    }
+
+    if(started) {
+        // Output is written straight from the buffers of the writer, or kept
+        // in 'scratch' if there's no writer
+        struct TrimState state;
+        trim_init(&state, newline_type, trailing_newline, strip);
+        struct PipelineBlock* out_block = NULL;
+        struct TrimBuffer* out = &scratch->out;
+        if(out_file != NULL) {
+            out_block = queue_take(&pipeline, &pipeline.free_out, NULL);
+            out = &out_block->buffer;
+        }
+        out->len = 0;
+        uint64_t bytes_read = 0;
+        while(true) {
+            struct PipelineBlock* in = queue_take(
+                &pipeline, &pipeline.full_in, NULL
+            );
+            if(!in->len) {
+                break;
+            }
+            uint64_t mark = trim_lap_start(stats);
+            trim_block(&state, in->data, in->len, out);
+            trim_lap(stats, TRIM_TRANSFORM, &mark);
+            bytes_read += in->len;
+            queue_put(&pipeline, &pipeline.free_in, in);
+
+            size_t decided = trim_decided(&state, out);
+            if(out_file == NULL) {
+                if(trim_changed(&state)) {
+                    break;
+                }
+                trim_release(&state, out, decided);
+            } else if(decided) {
+                // Queue the decided output to be written, carrying the rest
+                // over to the start of the next buffer
+                struct PipelineBlock* next = queue_take(
+                    &pipeline, &pipeline.free_out, NULL
+                );
+                next->buffer.len = 0;
+                trim_reserve(&next->buffer, out->len - decided);
+                memcpy(
+                    next->buffer.data, out->data + decided,
+                    out->len - decided
+                );
+                next->buffer.len = out->len - decided;
+                out->len = decided;
+                state.flushed += decided;
+                queue_put(&pipeline, &pipeline.full_out, out_block);
+                out_block = next;
+                out = &next->buffer;
+            }
+        }
+        if(out_file != NULL || !trim_changed(&state)) {
+            uint64_t mark = trim_lap_start(stats);
+            trim_finish(&state, out);
+            trim_lap(stats, TRIM_TRANSFORM, &mark);
+        }
+        uint64_t bytes_written = state.flushed + out->len;
+        if(out_file != NULL) {
+            queue_put(&pipeline, &pipeline.full_out, out_block);
+            pipeline_signal(&pipeline, &pipeline.finished);
+            pthread_join(writer, NULL);
+        }
+        pipeline_signal(&pipeline, &pipeline.stop);
+        pthread_join(reader, NULL);
+
+        if(stats != NULL) {
+            stats->bytes_read += bytes_read;
+            if(out_file != NULL) {
+                stats->bytes_written += bytes_written;
+            }
+            stats->phase_ns[TRIM_READ] += pipeline.read_ns;
+            stats->phase_ns[TRIM_WRITE] += pipeline.write_ns;
+            trim_tally(stats, &state);
+        }
+        *changed = trim_changed(&state);
+    }
+
+    for(size_t i = 0; i < 2 * depth; ++i) {
+        free(blocks[i].buffer.data);
+    }
+    free(blocks);
+    free(rings);
+    pthread_cond_destroy(&pipeline.cond);
+    pthread_mutex_destroy(&pipeline.lock);
+    return started;
+}
+#endif // _WIN32
+
+bool trim_pipeline(FILE* in_file, const uint8_t* map, size_t map_len,
+                   FILE* out_file, struct Scratch* scratch, size_t buffer_len,
+                   size_t depth, enum NewlineType newline_type,
+                   bool trailing_newline, bool strip,
+                   struct TrimStats* stats) {
+#ifdef _WIN32
+    // Threads aren't used on Windows to avoid depending on winpthreads
+    (void)buffer_len;
+    (void)depth;
+#else
+    bool changed;
+    if(depth >= 2 && run_pipeline(
+            in_file, map, map_len, out_file, scratch, buffer_len, depth,
+            newline_type, trailing_newline, strip, stats, &changed)) {
+        return changed;
+    }
+#endif // _WIN32
+    if(map != NULL) {
+        return trim_memory(
+            map, map_len, out_file, &scratch->out, newline_type,
+            trailing_newline, strip, stats
+        );
+    }
+    return trim_stream(
+        in_file, out_file, &scratch->in, &scratch->out, newline_type,
+        trailing_newline, strip, stats
+    );
+}
@@ -0,0 +1,40 @@
+#ifndef NEWLINE_PIPELINE_H
+#define NEWLINE_PIPELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "args.h"
+#include "inplace.h"
+
+/* Files smaller than this are read, processed and written in turn rather than
+through a pipeline, as starting its threads would take longer than overlapping
+them saves (1 MiB) */
+static const size_t PipelineMin = 1024*1024;
+
+/* Default number of buffers between each pair of stages of a pipeline */
+static const size_t PipelineDepth = 4;
+
+/* Same as trim_stream(), but reads, processes and writes the file at the same
+time. A reader thread fills buffers of 'buffer_len' bytes from 'in_file', the
+calling thread runs the engine over each one, and a writer thread writes the
+output to 'out_file'. Up to 'depth' buffers are queued between each pair of
+stages, and are reused as they come back, so the disk stays busy while blocks
+are being processed.
+
+If 'map' is not NULL, the file is read from the 'map_len' bytes at 'map'
+instead, and the reader thread touches each page of the blocks ahead, so
+faulting them in overlaps with processing the blocks before them.
+
+If 'out_file' is NULL, there is no writer thread, and reading stops at the
+first block containing a change, as for trim_stream(). Falls back to
+trim_stream() or trim_memory(), using the buffers of 'scratch', if 'depth' is
+less than 2 or threads can't be started, and always on Windows. Adds to 'stats'
+if it isn't NULL, timing each stage as its own phase. */
+bool trim_pipeline(FILE* in_file, const uint8_t* map, size_t map_len,
+                   FILE* out_file, struct Scratch* scratch, size_t buffer_len,
+                   size_t depth, enum NewlineType newline_type,
+                   bool trailing_newline, bool strip, struct TrimStats* stats);
+
+#endif // NEWLINE_PIPELINE_H
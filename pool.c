@@ -0,0 +1,195 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include "pool.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <unistd.h>
+#endif // _WIN32
+
+static void run_serial(void* (*next)(void* context),
+                       void (*work)(void* context, void* item, size_t worker),
+                       void (*report)(void* context, void* item),
+                       void* context) {
+    void* item = next(context);
+    while(item != NULL) {
+        if(work != NULL) {
+            work(context, item, 0);
+        }
+        if(report != NULL) {
+            report(context, item);
+        }
+        item = next(context);
+    }
+}
+
+#ifndef _WIN32
+/* An item taken by a worker which hasn't been reported yet */
+struct PoolEntry {
+    void* item;
+    bool done;
+    struct PoolEntry* next;
+};
+
+struct Pool {
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;  // Signalled when items change or workers exit
+    bool exhausted;            // Set once 'next' has returned NULL
+    size_t num_running;        // Number of workers still running
+    size_t num_pending;        // Items taken but not yet reported
+    size_t max_pending;        // Most items to take before reporting any
+    struct PoolEntry* head;    // Oldest item not yet reported
+    struct PoolEntry* tail;    // Newest item
+    void* (*next)(void* context);
+    void (*work)(void* context, void* item, size_t worker);
+    void* context;
+};
+
+/* A worker thread */
+struct PoolThread {
+    pthread_t thread;
+    struct Pool* pool;
+    size_t index;
+};
+
+static void* pool_worker(void* arg) {
+    struct PoolThread* thread = arg;
+    struct Pool* pool = thread->pool;
+    pthread_mutex_lock(&pool->lock);
+    while(!pool->exhausted) {
+        if(pool->num_pending >= pool->max_pending) {
+            // Items finished behind a slow one are held until it's reported,
+            // so wait rather than letting them pile up
+            pthread_cond_wait(&pool->done_cond, &pool->lock);
+            continue;
+        }
+        void* item = pool->next(pool->context);
+        if(item == NULL) {
+            pool->exhausted = true;
+            break;
+        }
+        struct PoolEntry* entry = malloc(sizeof(struct PoolEntry));
+        *entry = (struct PoolEntry){.item = item, .done = false, .next = NULL};
+        if(pool->tail == NULL) {
+            pool->head = entry;
+        } else {
+            pool->tail->next = entry;
+        }
+        pool->tail = entry;
+        ++pool->num_pending;
+        pthread_mutex_unlock(&pool->lock);
+
+        if(pool->work != NULL) {
+            pool->work(pool->context, item, thread->index);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        entry->done = true;
+        pthread_cond_broadcast(&pool->done_cond);
+    }
+    pool->num_running -= 1;
+    pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+#endif // _WIN32
+
+void pool_run(size_t num_threads, void* (*next)(void* context),
+              void (*work)(void* context, void* item, size_t worker),
+              void (*report)(void* context, void* item), void* context) {
+#ifdef _WIN32
+    // Threads aren't used on Windows to avoid depending on winpthreads
+    (void)num_threads;
+    run_serial(next, work, report, context);
+#else
+    if(num_threads <= 1) {
+        run_serial(next, work, report, context);
+        return;
+    }
+
+    struct Pool pool = {
+        .exhausted = false,
+        .num_running = 0,
+        .num_pending = 0,
+        .max_pending = 2 * num_threads,
+        .head = NULL,
+        .tail = NULL,
+        .next = next,
+        .work = work,
+        .context = context
+    };
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.done_cond, NULL);
+    struct PoolThread* threads = malloc(
+        num_threads * sizeof(struct PoolThread)
+    );
+    size_t num_started = 0;
+    pthread_mutex_lock(&pool.lock);
+    for(; num_started < num_threads; ++num_started) {
+        threads[num_started].pool = &pool;
+        threads[num_started].index = num_started;
+        if(pthread_create(
+                &threads[num_started].thread, NULL, pool_worker,
+                &threads[num_started])) {
+            break;
+        }
+        pool.num_running += 1;
+    }
+    pthread_mutex_unlock(&pool.lock);
+    if(num_started == 0) {
+        // Couldn't start any threads, so do the work here instead
+        free(threads);
+        pthread_cond_destroy(&pool.done_cond);
+        pthread_mutex_destroy(&pool.lock);
+        run_serial(next, work, report, context);
+        return;
+    }
+
+    // Report each item in order as soon as it's done
+    pthread_mutex_lock(&pool.lock);
+    while(true) {
+        while((pool.head == NULL || !pool.head->done) &&
+                (pool.head != NULL || pool.num_running > 0)) {
+            pthread_cond_wait(&pool.done_cond, &pool.lock);
+        }
+        struct PoolEntry* entry = pool.head;
+        if(entry == NULL) {
+            break;
+        }
+        pool.head = entry->next;
+        if(pool.head == NULL) {
+            pool.tail = NULL;
+        }
+        --pool.num_pending;
+        pthread_cond_broadcast(&pool.done_cond);
+        pthread_mutex_unlock(&pool.lock);
+        if(report != NULL) {
+            report(context, entry->item);
+        }
+        free(entry);
+        pthread_mutex_lock(&pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    for(size_t i = 0; i < num_started; ++i) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    free(threads);
+    pthread_cond_destroy(&pool.done_cond);
+    pthread_mutex_destroy(&pool.lock);
+#endif // _WIN32
+}
+
+size_t pool_default_threads(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+#else
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return num_cpus > 0 ? (size_t)num_cpus : 1;
+#endif // _WIN32
+}
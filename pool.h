@@ -0,0 +1,32 @@
+#ifndef NEWLINE_POOL_H
+#define NEWLINE_POOL_H
+
+#include <stddef.h>
+
+/* Processes a stream of items using up to 'num_threads' worker threads.
+
+Workers take items from 'next', which returns NULL once there are no items
+left. Calls to 'next' are serialised, so it may walk directories or read a
+list without locking. 'work' is called on a worker thread for each item, along
+with the index of the worker, which is less than 'num_threads' and lets each
+worker keep its own resources to reuse between items. 'report' is called on
+the calling thread for each item, in the order 'next' returned them, once
+'work' has finished for that item. This keeps output deterministic. 'report'
+is the last function given the item, so may free it.
+
+Items are taken from 'next' as workers become free, so the number of items
+doesn't need to be known up front. Items finished while an earlier one is still
+being worked on are held until it's reported, so workers stop taking new items
+while 2 * 'num_threads' items have been taken but not reported. 'work' or
+'report' may be NULL.
+
+Runs everything on the calling thread if 'num_threads' is 1 or threads aren't
+supported. */
+void pool_run(size_t num_threads, void* (*next)(void* context),
+              void (*work)(void* context, void* item, size_t worker),
+              void (*report)(void* context, void* item), void* context);
+
+/* Returns the number of online CPUs, or 1 if it can't be determined. */
+size_t pool_default_threads(void);
+
+#endif // NEWLINE_POOL_H
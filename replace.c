@@ -0,0 +1,148 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include "replace.h"
+#include "tempfile.h"
+
+/* Name of the replacement while it's being written, if it needs one */
+static const char* const ReplaceFormat = ".newline_%.tmp";
+
+struct Replacement {
+    const char* name;        // File being replaced
+    struct TempFile* temp;   // Replacement, in the same directory as 'name'
+    struct timespec atime;   // Access time of the file being replaced
+};
+
+/* Copies every extended attribute of 'from' to 'to', which includes any ACLs.
+Returns false if any couldn't be copied. */
+static bool copy_xattrs(int from, int to) {
+    ssize_t names_len = flistxattr(from, NULL, 0);
+    if(names_len <= 0) {
+        // No attributes, or the filesystem doesn't support them
+        return names_len == 0 || errno == ENOTSUP;
+    }
+    char* names = malloc(names_len);
+    names_len = flistxattr(from, names, names_len);
+    bool success = names_len >= 0;
+    char* value = NULL;
+    size_t value_capacity = 0;
+    for(ssize_t i = 0; success && i < names_len; i += strlen(names + i) + 1) {
+        ssize_t value_len = fgetxattr(from, names + i, NULL, 0);
+        if(value_len < 0) {
+            success = false;
+            break;
+        }
+        if((size_t)value_len > value_capacity) {
+            value_capacity = value_len;
+            value = realloc(value, value_capacity);
+        }
+        value_len = fgetxattr(from, names + i, value, value_len);
+        success = value_len >= 0 &&
+            !fsetxattr(to, names + i, value, value_len, 0);
+    }
+    free(value);
+    free(names);
+    return success;
+}
+
+/* Gives 'to' the owner, group, permissions and extended attributes of the
+file 'from_stat' describes, open as 'from'. */
+static bool copy_metadata(int from, const struct stat* from_stat, int to) {
+    struct stat to_stat;
+    if(fstat(to, &to_stat)) {
+        return false;
+    }
+    // Changing the owner may clear the set-user-ID and set-group-ID bits, so
+    // it's done before the permissions are set
+    if((to_stat.st_uid != from_stat->st_uid ||
+            to_stat.st_gid != from_stat->st_gid) &&
+            fchown(to, from_stat->st_uid, from_stat->st_gid)) {
+        return false;
+    }
+    if(fchmod(to, from_stat->st_mode & 07777)) {
+        return false;
+    }
+    return copy_xattrs(from, to);
+}
+
+struct Replacement* replace_begin(const char* name, FILE* file) {
+    struct stat name_stat;
+    struct stat file_stat;
+    if(lstat(name, &name_stat) || fstat(fileno(file), &file_stat) ||
+            !S_ISREG(name_stat.st_mode) || name_stat.st_nlink > 1 ||
+            name_stat.st_dev != file_stat.st_dev ||
+            name_stat.st_ino != file_stat.st_ino) {
+        return NULL;
+    }
+
+    struct TempFile* temp = make_temp_file_beside(name, ReplaceFormat);
+    if(temp == NULL) {
+        return NULL;
+    }
+    if(!copy_metadata(fileno(file), &file_stat, fileno(temp->file))) {
+        fclose(temp->file);
+        if(temp->filename != NULL) {
+            unlink(temp->filename);
+        }
+        free_temp_file(temp);
+        return NULL;
+    }
+
+    struct Replacement* replacement = malloc(sizeof(struct Replacement));
+    *replacement = (struct Replacement){
+        .name = name,
+        .temp = temp,
+        .atime = file_stat.st_atim
+    };
+    return replacement;
+}
+
+FILE* replace_file(struct Replacement* replacement) {
+    return replacement->temp->file;
+}
+
+bool replace_commit(struct Replacement* replacement) {
+    FILE* file = replacement->temp->file;
+    // Writing sets the modification time as rewriting in place would, but the
+    // access time is kept
+    const struct timespec times[2] = {
+        replacement->atime,
+        {.tv_sec = 0, .tv_nsec = UTIME_OMIT}
+    };
+    // The data is flushed to disk before the rename, so a crash can't leave
+    // the name pointing at an empty or partly written file. An unnamed
+    // temporary file needs linking into the directory before it can be
+    // renamed over the original.
+    errno = 0;
+    if(fflush(file) || ferror(file) || futimens(fileno(file), times) ||
+            fsync(fileno(file)) ||
+            !link_temp_file(
+                replacement->temp, replacement->name, ReplaceFormat
+            ) ||
+            rename(replacement->temp->filename, replacement->name)) {
+        int error = errno ? errno : EIO;
+        replace_abort(replacement);
+        errno = error;
+        return false;
+    }
+    fclose(file);
+    free_temp_file(replacement->temp);
+    free(replacement);
+    return true;
+}
+
+void replace_abort(struct Replacement* replacement) {
+    fclose(replacement->temp->file);
+    if(replacement->temp->filename != NULL) {
+        unlink(replacement->temp->filename);
+    }
+    free_temp_file(replacement->temp);
+    free(replacement);
+}
@@ -0,0 +1,34 @@
+#ifndef NEWLINE_REPLACE_H
+#define NEWLINE_REPLACE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+struct Replacement;
+
+/* Starts replacing the file 'name', which is open as 'file', by creating a new
+file in the same directory to write the replacement to. The new file is given
+the owner, group, permissions, extended attributes and ACLs of 'file'.
+
+Returns NULL if the file can't be replaced without changing it other than its
+contents, such as when 'name' is a symbolic link, the file has more than one
+hard link, or its metadata can't be copied. The file should then be rewritten
+in place instead. */
+struct Replacement* replace_begin(const char* name, FILE* file);
+
+/* Returns the file the replacement should be written to. Writes may be
+positioned anywhere in the file. */
+FILE* replace_file(struct Replacement* replacement);
+
+/* Flushes the replacement to disk, then renames it over the file it replaces,
+which is done atomically, then frees 'replacement'. The replacement's access
+time is set to that of the original file. If the replacement couldn't be
+completely written or renamed, it's deleted, the original file is left as it
+was, and false is returned with errno set. */
+bool replace_commit(struct Replacement* replacement);
+
+/* Deletes the replacement, leaving the original file as it was, then frees
+'replacement'. */
+void replace_abort(struct Replacement* replacement);
+
+#endif // NEWLINE_REPLACE_H
@@ -0,0 +1,128 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define SCAN_X86
+    #include <immintrin.h>
+#endif
+
+/* Scalar kernel, testing 8 bytes at a time for CR or LF. A byte of
+'word ^ pattern' is zero where 'word' contains the byte being searched for. */
+static const uint8_t* scan_newline_scalar(const uint8_t* cur,
+                                          const uint8_t* end) {
+    const uint64_t ones = 0x0101010101010101;
+    const uint64_t highs = 0x8080808080808080;
+    while(end - cur >= 8) {
+        uint64_t word;
+        memcpy(&word, cur, 8);
+        uint64_t cr = word ^ (ones * '\r');
+        uint64_t lf = word ^ (ones * '\n');
+        if((((cr - ones) & ~cr) | ((lf - ones) & ~lf)) & highs) {
+            break;
+        }
+        cur += 8;
+    }
+    while(cur < end && *cur != '\r' && *cur != '\n') {
+        ++cur;
+    }
+    return cur;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static const uint8_t* scan_newline_sse2(const uint8_t* cur,
+                                        const uint8_t* end) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    while(end - cur >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)cur);
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(bytes, cr), _mm_cmpeq_epi8(bytes, lf)
+        ));
+        if(mask) {
+            return cur + __builtin_ctz(mask);
+        }
+        cur += 16;
+    }
+    return scan_newline_scalar(cur, end);
+}
+
+__attribute__((target("avx2")))
+static const uint8_t* scan_newline_avx2(const uint8_t* cur,
+                                        const uint8_t* end) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    // Test 64 bytes per iteration, since lines are usually longer than 32
+    while(end - cur >= 64) {
+        __m256i lo = _mm256_loadu_si256((const __m256i*)cur);
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(cur + 32));
+        __m256i lo_match = _mm256_or_si256(
+            _mm256_cmpeq_epi8(lo, cr), _mm256_cmpeq_epi8(lo, lf)
+        );
+        __m256i hi_match = _mm256_or_si256(
+            _mm256_cmpeq_epi8(hi, cr), _mm256_cmpeq_epi8(hi, lf)
+        );
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(lo_match) |
+            ((uint64_t)(uint32_t)_mm256_movemask_epi8(hi_match) << 32);
+        if(mask) {
+            return cur + __builtin_ctzll(mask);
+        }
+        cur += 64;
+    }
+    while(end - cur >= 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)cur);
+        uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_cmpeq_epi8(bytes, cr), _mm256_cmpeq_epi8(bytes, lf)
+        ));
+        if(mask) {
+            return cur + __builtin_ctz(mask);
+        }
+        cur += 32;
+    }
+    return scan_newline_sse2(cur, end);
+}
+#endif // SCAN_X86
+
+/* Every kernel, fastest first. Each CPU supports a run of them ending with the
+scalar kernel. */
+static const struct ScanKernel ScanKernels[] = {
+#ifdef SCAN_X86
+    {"avx2", scan_newline_avx2},
+    {"sse2", scan_newline_sse2},
+#endif // SCAN_X86
+    {"scalar", scan_newline_scalar}
+};
+
+size_t scan_kernels(const struct ScanKernel** kernels) {
+    size_t first = 0;
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if(!__builtin_cpu_supports("avx2")) {
+        first = __builtin_cpu_supports("sse2") ? 1 : 2;
+    }
+#endif // SCAN_X86
+    *kernels = &ScanKernels[first];
+    return sizeof(ScanKernels) / sizeof(struct ScanKernel) - first;
+}
+
+static const uint8_t* scan_newline_resolve(const uint8_t* cur,
+                                           const uint8_t* end) {
+    const struct ScanKernel* kernels;
+    scan_kernels(&kernels);
+    scan_newline = kernels[0].scan;
+    return scan_newline(cur, end);
+}
+
+const uint8_t* (*scan_newline)(const uint8_t* cur, const uint8_t* end) =
+    scan_newline_resolve;
+
+#ifdef __GNUC__
+/* Picks the kernel before main() runs, so that it's never picked while other
+threads may be scanning. */
+__attribute__((constructor))
+static void scan_init(void) {
+    scan_newline_resolve(NULL, NULL);
+}
+#endif // __GNUC__
@@ -0,0 +1,24 @@
+#ifndef NEWLINE_SCAN_H
+#define NEWLINE_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Returns a pointer to the first CR or LF character between 'cur' and 'end',
+or 'end' if there isn't one. Points to the fastest kernel supported by the
+CPU, which is picked using CPUID at startup. A scalar kernel is used on CPUs
+without SSE2 or AVX2, and on other architectures. */
+extern const uint8_t* (*scan_newline)(const uint8_t* cur, const uint8_t* end);
+
+/* A kernel scan_newline may point to */
+struct ScanKernel {
+    const char* name;  // Instruction set it uses
+    const uint8_t* (*scan)(const uint8_t* cur, const uint8_t* end);
+};
+
+/* Sets 'kernels' to every kernel supported by the CPU, fastest first, and
+returns how many there are. The first is the one scan_newline points to, so
+tests point scan_newline at each of the others in turn. */
+size_t scan_kernels(const struct ScanKernel** kernels);
+
+#endif // NEWLINE_SCAN_H
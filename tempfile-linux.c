@@ -1,28 +1,39 @@
+#define _GNU_SOURCE // O_TMPFILE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <paths.h>
+#include <sys/random.h>
 #include <unistd.h>
 #include "tempfile.h"
 
-struct TempFile* make_temp_file(const char* format) {
-    // No standardised way to getting the temporary directory on Linux, however
-    // the most common way is to use the first available directory out of
-    // $TMPDIR, P_tmpdir, _PATH_TMP or /tmp/ in that order.
-    const char* temp_dir = getenv("TMPDIR");
-    #ifdef P_tmpdir
-    if(temp_dir == NULL || temp_dir[0] == '\0') {
-        temp_dir = P_tmpdir;
-    }
-    #endif
-    #ifdef _PATH_TMP
-    if(temp_dir == NULL || temp_dir[0] == '\0') {
-        temp_dir = _PATH_TMP;
-    }
-    #endif
-    if(temp_dir == NULL || temp_dir[0] == '\0') {
-        temp_dir = "/tmp/";
+static const char alpha_num[] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+/* Returns the directory containing 'name', which the caller must free */
+static char* parent_dir(const char* name) {
+    const char* slash = strrchr(name, '/');
+    if(slash == NULL) {
+        return strdup(".");
     }
+    size_t len = slash == name ? 1 : (size_t)(slash - name);
+    char* dir = malloc(len + 1);
+    memcpy(dir, name, len);
+    dir[len] = '\0';
+    return dir;
+}
+
+/* Returns the path of a file named by 'format' in the directory 'temp_dir',
+with the wildcard replaced by 'XXXXXX' for mkstemps(), setting 'suffix_len' to
+the length of the text after it. The caller must free the path. Returns NULL if
+'format' does not contain a single '%' character. */
+static char* make_template(const char* temp_dir, const char* format,
+                           size_t* suffix_len) {
     size_t temp_dir_len = strlen(temp_dir);
 
     size_t temp_file_len = temp_dir_len + strlen(format) + 5;
@@ -44,17 +55,16 @@ struct TempFile* make_temp_file(const char* format) {
 
     // Find the wildcard ('%'), and replace it with 'XXXXXX' for mkstemp().
     size_t wildcard_i;
-    size_t suffix_len;
     for(wildcard_i = temp_dir_len; wildcard_i < temp_file_len - 5;
             ++wildcard_i) {
         if(temp_file[wildcard_i] == '%') {
-            suffix_len = strlen(temp_file + wildcard_i + 1);
-            if(suffix_len) {
+            *suffix_len = strlen(temp_file + wildcard_i + 1);
+            if(*suffix_len) {
                 // Can't use memcpy since regions overlap, so manually do a
                 // backwards copy.
-                for(size_t j = 0; j < suffix_len; ++j) {
+                for(size_t j = 0; j < *suffix_len; ++j) {
                     temp_file[temp_file_len - j - 1] = temp_file[
-                        wildcard_i + suffix_len - j
+                        wildcard_i + *suffix_len - j
                     ];
                 }
             }
@@ -72,9 +82,25 @@ struct TempFile* make_temp_file(const char* format) {
         free(temp_file);
         return NULL;
     }
+    return temp_file;
+}
+
+/* Creates a temporary file in the directory 'temp_dir'. O_TMPFILE is tried
+first, falling back to a named file where it isn't supported. */
+static struct TempFile* make_temp_file_at(const char* temp_dir,
+                                          const char* format) {
+    size_t suffix_len;
+    char* temp_file = make_template(temp_dir, format, &suffix_len);
+    if(temp_file == NULL) {
+        return NULL;
+    }
+
     // Open the temporary file
-    int fd;
-    if(suffix_len == 0) {
+    int fd = open(temp_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if(fd != -1) {
+        free(temp_file);
+        temp_file = NULL;
+    } else if(suffix_len == 0) {
         fd = mkstemp(temp_file);
     } else {
         fd = mkstemps(temp_file, suffix_len);
@@ -87,8 +113,10 @@ struct TempFile* make_temp_file(const char* format) {
     FILE* file = fdopen(fd, "w+b");
     if(file == NULL) {
         close(fd);
-        unlink(temp_file);
-        free(temp_file);
+        if(temp_file != NULL) {
+            unlink(temp_file);
+            free(temp_file);
+        }
         return NULL;
     }
     setvbuf(file, NULL, _IOFBF, FileBufferLen);
@@ -99,6 +127,77 @@ struct TempFile* make_temp_file(const char* format) {
     return result;
 }
 
+struct TempFile* make_temp_file(const char* format) {
+    // No standardised way to getting the temporary directory on Linux, however
+    // the most common way is to use the first available directory out of
+    // $TMPDIR, P_tmpdir, _PATH_TMP or /tmp/ in that order.
+    const char* temp_dir = getenv("TMPDIR");
+    #ifdef P_tmpdir
+    if(temp_dir == NULL || temp_dir[0] == '\0') {
+        temp_dir = P_tmpdir;
+    }
+    #endif
+    #ifdef _PATH_TMP
+    if(temp_dir == NULL || temp_dir[0] == '\0') {
+        temp_dir = _PATH_TMP;
+    }
+    #endif
+    if(temp_dir == NULL || temp_dir[0] == '\0') {
+        temp_dir = "/tmp/";
+    }
+    return make_temp_file_at(temp_dir, format);
+}
+
+struct TempFile* make_temp_file_beside(const char* name,
+                                       const char* format) {
+    char* dir = parent_dir(name);
+    struct TempFile* result = make_temp_file_at(dir, format);
+    free(dir);
+    return result;
+}
+
+bool link_temp_file(struct TempFile* temp, const char* name,
+                    const char* format) {
+    if(temp->filename != NULL) {
+        return true;
+    }
+    char* dir = parent_dir(name);
+    size_t suffix_len;
+    char* temp_file = make_template(dir, format, &suffix_len);
+    free(dir);
+    if(temp_file == NULL) {
+        return false;
+    }
+    char* wildcard = temp_file + strlen(temp_file) - suffix_len - 6;
+    char proc_path[32];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d",
+             fileno(temp->file));
+
+    // linkat() won't replace an existing file, so keep trying random names
+    // until one is free, as mkstemp() does
+    for(int attempt = 0; attempt < 100; ++attempt) {
+        uint8_t random[6];
+        if(getrandom(random, sizeof(random), 0) != sizeof(random)) {
+            break;
+        }
+        for(size_t i = 0; i < sizeof(random); ++i) {
+            wildcard[i] = alpha_num[random[i] % (sizeof(alpha_num) - 1)];
+        }
+        // Linking the file descriptor itself with AT_EMPTY_PATH needs extra
+        // privileges, but linking its /proc entry doesn't
+        if(!linkat(AT_FDCWD, proc_path, AT_FDCWD, temp_file,
+                AT_SYMLINK_FOLLOW)) {
+            temp->filename = temp_file;
+            return true;
+        }
+        if(errno != EEXIST) {
+            break;
+        }
+    }
+    free(temp_file);
+    return false;
+}
+
 void free_temp_file(struct TempFile* temp) {
     free((char*)temp->filename);
     free(temp);
@@ -1,6 +1,7 @@
 #ifndef NEWLINE_TEMPFILE_H
 #define NEWLINE_TEMPFILE_H
 
+#include <stdbool.h>
 #include <stdio.h>
 #ifdef _WIN32
 #include <wchar.h>
@@ -25,6 +26,22 @@ make the filename unique. Returns NULL if 'format' does not contain a single
 '%' character, or if a temporary file was not able to be created. */
 struct TempFile* make_temp_file(const char* format);
 
+#ifdef __linux__
+/* Same as make_temp_file(), but creates the temporary file in the directory
+containing the file 'name', so on the same filesystem.
+
+On Linux, temporary files are created with O_TMPFILE where the filesystem
+supports it. Such files have no name, so 'filename' is NULL, and are deleted
+once closed, even if the process is killed. */
+struct TempFile* make_temp_file_beside(const char* name, const char* format);
+
+/* Gives 'temp' a name in the directory containing the file 'name' if it
+doesn't have one yet, using 'format' as make_temp_file() does, and sets its
+'filename'. Returns false if it wasn't able to be named. */
+bool link_temp_file(struct TempFile* temp, const char* name,
+                    const char* format);
+#endif // __linux__
+
 /* Releases memory allocated by make_temp_file. This does not close the file
 handle associated with the temporary file, nor deletes it. */
 void free_temp_file(struct TempFile* tempfile);
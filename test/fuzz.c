@@ -0,0 +1,25 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "args.h"
+#include "trim.h"
+#include "verify.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+/* Entry point for libFuzzer. The first byte of each input picks the options:
+its low two bits the newline type, the next bit '-N' and the one after '-S'.
+The rest is checked against trim_file() with every engine, and with the block
+engine using every scan kernel, which aborts if any result differs. */
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if(!size) {
+        return 0;
+    }
+    struct Arguments args = {
+        .newline_type = data[0] & 3,
+        .trailing_newline = !(data[0] & 4),
+        .strip_whitespace = !(data[0] & 8)
+    };
+    verify_options("fuzz input", data + 1, size - 1, &args);
+    verify_kernels("fuzz input", data + 1, size - 1, &args);
+    return 0;
+}
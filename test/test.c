@@ -0,0 +1,274 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+    #include <sys/mman.h>
+#endif // __linux__
+#include <unistd.h>
+#include "args.h"
+#include "binary.h"
+#include "inplace.h"
+#ifdef __linux__
+    #include "parallel.h"
+#endif // __linux__
+#include "tempfile.h"
+#include "trim.h"
+#include "verify.h"
+
+/* Seed of the random inputs, so every run tests exactly the same inputs */
+static const uint64_t TestSeed = 0x6e65776c696e65;
+
+/* Number of random inputs */
+static const size_t TestNumRandom = 100;
+
+/* Bytes random inputs are made of, weighted towards those the engines treat
+specially */
+static const char TestBytes[] = "ab  \t\t\r\r\n\n\n\v\f\xe9";
+
+/* Offsets where the engines split their input: pages and the blocks read by
+trim_tail(), the buffers of files, the largest small file and the blocks of
+the block engine */
+static const size_t TestBoundaries[] = {
+    4*1024, FileBufferLen, SmallFileMax, TrimBlockLen
+};
+
+/* Text in legacy 8-bit encodings, which is never taken for binary data */
+static const char* const TestLegacyNames[] = {"ISO-8859-1", "Windows-1251"};
+static const char* const TestLegacyText[] = {
+    "\xc7" "a co\xfbte tr\xe8s cher \xe0 Gen\xe8ve.  \r\n",
+    "\xcf\xf0\xe8\xe2\xe5\xf2, \xec\xe8\xf0! \t\r\n"
+    "\xc4\xee \xf1\xe2\xe8\xe4\xe0\xed\xe8\xff.\r\n"
+};
+
+/* Number of inputs tested so far */
+static size_t num_tested = 0;
+
+/* Returns the next number in the sequence 'state' (SplitMix64) */
+static uint64_t test_next(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+/* Checks every engine, and the block engine with every scan kernel, against
+trim_file() over the 'len' bytes at 'in', the input 'name', with every
+combination of options */
+static void test_input(const char* name, const uint8_t* in, size_t len) {
+    for(int type = LF; type <= KEEP; ++type) {
+        for(int trailing = 0; trailing < 2; ++trailing) {
+            for(int strip = 0; strip < 2; ++strip) {
+                struct Arguments args = {
+                    .newline_type = type,
+                    .trailing_newline = trailing,
+                    .strip_whitespace = strip
+                };
+                verify_options(name, in, len, &args);
+                verify_kernels(name, in, len, &args);
+            }
+        }
+    }
+    ++num_tested;
+}
+
+/* Same as test_input(), for a string */
+static void test_string(const char* name, const char* in) {
+    test_input(name, (const uint8_t*)in, strlen(in));
+}
+
+/* Returns 'len' bytes repeating 'pattern', which the caller must free */
+static uint8_t* repeat(const char* pattern, size_t len) {
+    size_t pattern_len = strlen(pattern);
+    uint8_t* data = malloc(len + 1);
+    for(size_t i = 0; i < len; ++i) {
+        data[i] = pattern[i % pattern_len];
+    }
+    return data;
+}
+
+/* Inputs which have broken engines before, or could */
+static void test_adversarial(void) {
+    test_string("an empty file", "");
+    test_string("a file of only spaces and tabs", "  \t \t\t  ");
+    test_string("a file of only whitespace", " \t\n  \r\n\t\r \n\v\f  ");
+    test_string("a file of only LFs", "\n\n\n\n");
+    test_string("a file of only CRLFs", "\r\n\r\n\r\n");
+    test_string("a file of only CRs", "\r\r\r");
+    test_string("a lone CR", "\r");
+    test_string("a mixed newline run", "a\r\n\n\r\r\n\rb\n\r\n\r");
+    test_string(
+        "mixed newline runs with whitespace",
+        "a \r\n\t\n \r\r\n  b\t\r \n\r\n \r"
+    );
+    test_string("no trailing newline", "a\nb \t");
+    test_string("a trailing CR after whitespace", "a \t\r");
+
+    // CRs, CRLF pairs and whitespace either side of every boundary
+    char name[128];
+    for(size_t i = 0; i < sizeof(TestBoundaries) / sizeof(size_t); ++i) {
+        size_t boundary = TestBoundaries[i];
+        size_t len = boundary + 8;
+        uint8_t* data = repeat("x", len);
+        data[boundary - 1] = '\r';
+        snprintf(name, sizeof(name), "a CR ending at offset %zu", boundary);
+        test_input(name, data, len);
+        data[boundary] = '\n';
+        snprintf(name, sizeof(name), "a CRLF split at offset %zu", boundary);
+        test_input(name, data, len);
+        data[boundary - 2] = ' ';
+        data[boundary + 1] = '\r';
+        snprintf(
+            name, sizeof(name), "whitespace and newlines at offset %zu",
+            boundary
+        );
+        test_input(name, data, len);
+        free(data);
+    }
+
+    // Runs of trailing newlines and whitespace longer than a file buffer
+    size_t run_len = FileBufferLen + FileBufferLen / 4;
+    const char* const runs[] = {"\n", "\r\n", "\r", "\n\r\n\r", " ", " \t"};
+    for(size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); ++i) {
+        uint8_t* data = repeat(runs[i], run_len);
+        data[0] = 'a';
+        snprintf(name, sizeof(name), "a long run of \"%s\"", runs[i]);
+        test_input(name, data, run_len);
+        free(data);
+    }
+    uint8_t* data = repeat(" \t", run_len);
+    data[0] = 'a';
+    data[run_len - 1] = '\n';
+    test_input("a long line of trailing whitespace", data, run_len);
+    free(data);
+
+    // A run of CRLFs across a block, with the output growing past the input
+    // as LFs become CRLFs
+    size_t grow_len = TrimBlockLen + TrimBlockLen / 8;
+    data = repeat("a\n", grow_len);
+    for(size_t i = TrimBlockLen - 64; i < grow_len; i += 2) {
+        memcpy(data + i, "\r\n", 2);
+    }
+    test_input("a long run of CRLFs across a block", data, grow_len);
+    free(data);
+}
+
+/* Checks 'len' bytes at 'in', the input 'name', are taken for binary data if
+'binary', or for text otherwise, exiting if not */
+static void test_detect(const char* name, const uint8_t* in, size_t len,
+                        bool binary) {
+    if(binary_detect(in, len) != binary) {
+        fprintf(
+            stderr, "test: %s was taken for %s\n", name,
+            binary ? "text" : "binary data"
+        );
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Text in legacy encodings, which must still be processed, and binary data
+which must still be skipped */
+static void test_binary(void) {
+    for(size_t i = 0; i < sizeof(TestLegacyText) / sizeof(char*); ++i) {
+        uint8_t* data = repeat(TestLegacyText[i], BinarySampleLen);
+        test_detect(TestLegacyNames[i], data, BinarySampleLen, false);
+        test_input(TestLegacyNames[i], data, BinarySampleLen);
+        free(data);
+    }
+    uint8_t data[255];
+    for(size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = i + 1;
+    }
+    test_detect("binary data without a NUL", data, sizeof(data), true);
+}
+
+/* Checks 'engine' set the 'error' of 'scratch' after failing to write, exiting
+if not, then clears it */
+static void test_failed(const char* engine, struct Scratch* scratch) {
+    if(!scratch->error) {
+        fprintf(stderr, "test: %s didn't report failing to write\n", engine);
+        exit(EXIT_FAILURE);
+    }
+    scratch->error = 0;
+}
+
+/* Engines rewriting a file in place, which must report when they can't */
+static void test_write_errors(void) {
+    static const char Data[] = "a \r\nb\n\n\n";
+    char name[] = "newline-test.XXXXXX";
+    int fd = mkstemp(name);
+    if(fd == -1 || write(fd, Data, sizeof(Data) - 1) != sizeof(Data) - 1) {
+        perror("test: can't create a file");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    // Opened read-only, so every write fails
+    FILE* file = fopen(name, "rb");
+    struct Scratch scratch = {
+        .in = {NULL, 0, 0},
+        .out = {NULL, 0, 0},
+        .temp = NULL,
+        .error = 0
+    };
+    trim_small(file, false, &scratch, LF, true, true, NULL);
+    test_failed("trim_small()", &scratch);
+    trim_in_place(file, name, NULL, 0, &scratch, LF, true, true, NULL);
+    test_failed("trim_in_place()", &scratch);
+    bool changed;
+    trim_tail(
+        file, false, NULL, 0, &scratch, KEEP, true, false, NULL, &changed
+    );
+    test_failed("trim_tail()", &scratch);
+#ifdef __linux__
+    size_t len = sizeof(Data) - 1;
+    uint8_t* map = mmap(NULL, len, PROT_READ, MAP_SHARED, fileno(file), 0);
+    trim_parallel(
+        file, name, NULL, map, len, 2, 1, &scratch, LF, true, true, NULL
+    );
+    munmap(map, len);
+    test_failed("trim_parallel()", &scratch);
+#endif // __linux__
+    fclose(file);
+    remove(name);
+    scratch_free(&scratch);
+}
+
+/* Random inputs, mostly short, with runs of the same byte */
+static void test_random(void) {
+    uint64_t state = TestSeed;
+    char name[64];
+    for(size_t i = 0; i < TestNumRandom; ++i) {
+        uint64_t pick = test_next(&state) % 100;
+        size_t max_len = pick < 70 ? 200 : pick < 95 ? 5000 : 100*1024;
+        size_t len = test_next(&state) % (max_len + 1);
+        uint8_t* data = malloc(len + 1);
+        size_t offset = 0;
+        while(offset < len) {
+            uint8_t byte = TestBytes[
+                test_next(&state) % (sizeof(TestBytes) - 1)
+            ];
+            size_t run = test_next(&state) % 4 ? 1 :
+                1 + test_next(&state) % 64;
+            for(; run && offset < len; --run) {
+                data[offset++] = byte;
+            }
+        }
+        snprintf(name, sizeof(name), "random input %zu", i);
+        test_input(name, data, len);
+        free(data);
+    }
+}
+
+int main(void) {
+    test_adversarial();
+    test_binary();
+    test_write_errors();
+    test_random();
+    printf(
+        "All engines matched trim_file() for %zu inputs with every "
+        "combination of options\n", num_tested
+    );
+    return EXIT_SUCCESS;
+}
@@ -2,8 +2,15 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
-#include "args.h"
+#ifdef _WIN32
+    #include <windows.h>
+#endif // _WIN32
+#include "libnewline.h"
+#include "scan.h"
 #include "trim.h"
 
 bool trim_file(FILE* in_file, FILE* out_file, enum NewlineType newline_type,
@@ -153,3 +160,463 @@ bool trim_file(FILE* in_file, FILE* out_file, enum NewlineType newline_type,
     }
     return changes_made;
 }
+
+void trim_init(struct TrimState* state, enum NewlineType newline_type,
+               bool trailing_newline, bool strip) {
+    *state = (struct TrimState){
+        .newline_type = newline_type,
+        .trailing_newline = trailing_newline,
+        .strip = strip,
+        .pending_cr = false,
+        .pending_newline = 0,
+        .pending_whitespace = 0,
+        .num_lf = 0,
+        .num_crlf = 0,
+        .num_cr = 0,
+        .stripped = 0,
+        .newlines_removed = 0,
+        .newline_added = false,
+        .flushed = 0,
+        .first_change = -1
+    };
+}
+
+void trim_reserve(struct TrimBuffer* out, size_t len) {
+    if(out->capacity - out->len >= len) {
+        return;
+    }
+    // Grow buffer by factor of 1.5, or to the required size if larger
+    size_t new_capacity = out->capacity + out->capacity / 2;
+    if(new_capacity < out->len + len) {
+        new_capacity = out->len + len;
+    }
+    out->data = realloc(out->data, new_capacity);
+    out->capacity = new_capacity;
+}
+
+static void record_change(struct TrimState* state,
+                          const struct TrimBuffer* out, size_t ahead) {
+    // Undecided output can be removed after a change was recorded in it, so
+    // the first change can move backwards
+    off_t offset = state->flushed + (off_t)(out->len + ahead);
+    if(state->first_change == -1 || offset < state->first_change) {
+        state->first_change = offset;
+    }
+}
+
+#ifdef __GNUC__
+    #define TRIM_INLINE inline __attribute__((always_inline))
+#else
+    #define TRIM_INLINE inline
+#endif // __GNUC__
+
+/* The functions below take the options as arguments rather than reading them
+from the state, and are always inlined into the kernels made by TRIM_KERNEL(),
+which pass constants so every check of an option is folded away. */
+
+static TRIM_INLINE void write_text(struct TrimState* state,
+                                   struct TrimBuffer* out,
+                                   const uint8_t* text, size_t len,
+                                   bool strip) {
+    memcpy(out->data + out->len, text, len);
+    out->len += len;
+    if(!strip) {
+        // Any character ends a run of newlines when whitespace is kept
+        state->pending_newline = 0;
+        return;
+    }
+    size_t whitespace = 0;
+    while(whitespace < len && (text[len - whitespace - 1] == ' ' ||
+            text[len - whitespace - 1] == '\t')) {
+        ++whitespace;
+    }
+    if(whitespace == len) {
+        // Only whitespace, which may still be stripped along with any
+        // whitespace before it
+        state->pending_whitespace += len;
+    } else {
+        state->pending_newline = 0;
+        state->pending_whitespace = whitespace;
+    }
+}
+
+static TRIM_INLINE void write_newline(struct TrimState* state,
+                                      struct TrimBuffer* out,
+                                      enum NewlineType cur_newline,
+                                      enum NewlineType newline_type,
+                                      bool trailing_newline, bool strip) {
+    if(cur_newline == LF) {
+        state->num_lf += 1;
+    } else if(cur_newline == CRLF) {
+        state->num_crlf += 1;
+    } else {
+        state->num_cr += 1;
+    }
+
+    // Handle trailing whitespace
+    if(strip && state->pending_whitespace > 0) {
+        out->len -= state->pending_whitespace;
+        state->stripped += state->pending_whitespace;
+        state->pending_whitespace = 0;
+        record_change(state, out, 0);
+    }
+
+    // Write newline
+    enum NewlineType newline_to_write = cur_newline;
+    if(newline_type != KEEP && newline_type != cur_newline) {
+        // CR and CRLF only differ after the CR
+        record_change(state, out, cur_newline != LF && newline_type != LF);
+        newline_to_write = newline_type;
+    }
+    size_t newline_len = 1;
+    if(newline_to_write == LF) {
+        out->data[out->len] = '\n';
+    } else if(newline_to_write == CRLF) {
+        out->data[out->len] = '\r';
+        out->data[out->len + 1] = '\n';
+        newline_len = 2;
+    } else {
+        out->data[out->len] = '\r';
+    }
+    out->len += newline_len;
+    if(trailing_newline) {
+        state->pending_newline += newline_len;
+    }
+}
+
+static TRIM_INLINE void block_kernel(struct TrimState* state,
+                                     const uint8_t* in, size_t in_len,
+                                     struct TrimBuffer* out,
+                                     enum NewlineType newline_type,
+                                     bool trailing_newline, bool strip) {
+    const uint8_t* cur = in;
+    const uint8_t* end = in + in_len;
+    if(state->pending_cr && cur < end) {
+        state->pending_cr = false;
+        if(*cur == '\n') {
+            write_newline(
+                state, out, CRLF, newline_type, trailing_newline, strip
+            );
+            ++cur;
+        } else {
+            write_newline(
+                state, out, CR, newline_type, trailing_newline, strip
+            );
+        }
+    }
+    while(cur < end) {
+        const uint8_t* newline = scan_newline(cur, end);
+        if(newline != cur) {
+            write_text(state, out, cur, newline - cur, strip);
+        }
+        if(newline == end) {
+            break;
+        }
+        enum NewlineType cur_newline;
+        if(*newline == '\n') {
+            cur_newline = LF;
+            cur = newline + 1;
+        } else if(newline + 1 == end) {
+            // CR at the end of the block, need the next block to determine
+            // whether or not it's part of a CRLF
+            state->pending_cr = true;
+            break;
+        } else if(newline[1] == '\n') {
+            cur_newline = CRLF;
+            cur = newline + 2;
+        } else {
+            cur_newline = CR;
+            cur = newline + 1;
+        }
+        write_newline(
+            state, out, cur_newline, newline_type, trailing_newline, strip
+        );
+    }
+}
+
+/* Processes a block with the options given, the same as trim_block() */
+typedef void (*TrimKernel)(struct TrimState* state, const uint8_t* in,
+                           size_t in_len, struct TrimBuffer* out);
+
+/* Defines a copy of block_kernel() specialised for one combination of
+options */
+#define TRIM_KERNEL(type, trailing, strip) \
+    static void block_##type##_##trailing##_##strip( \
+            struct TrimState* state, const uint8_t* in, size_t in_len, \
+            struct TrimBuffer* out) { \
+        block_kernel(state, in, in_len, out, type, trailing, strip); \
+    }
+
+#define TRIM_KERNELS(type) \
+    TRIM_KERNEL(type, false, false) \
+    TRIM_KERNEL(type, false, true) \
+    TRIM_KERNEL(type, true, false) \
+    TRIM_KERNEL(type, true, true)
+
+TRIM_KERNELS(LF)
+TRIM_KERNELS(CRLF)
+TRIM_KERNELS(CR)
+TRIM_KERNELS(KEEP)
+
+#define TRIM_KERNEL_ROW(type) { \
+    {block_##type##_false_false, block_##type##_false_true}, \
+    {block_##type##_true_false, block_##type##_true_true} \
+}
+
+/* Kernels indexed by newline type, trailing newline, then strip */
+static const TrimKernel TrimKernels[4][2][2] = {
+    TRIM_KERNEL_ROW(LF),
+    TRIM_KERNEL_ROW(CRLF),
+    TRIM_KERNEL_ROW(CR),
+    TRIM_KERNEL_ROW(KEEP)
+};
+
+void trim_block(struct TrimState* state, const uint8_t* in, size_t in_len,
+                struct TrimBuffer* out) {
+    // Worst case is a CR from the previous block followed by nothing but lone
+    // LFs, all of which are converted to CRLFs
+    trim_reserve(out, 2 * in_len + 2);
+    TrimKernels[state->newline_type][state->trailing_newline][state->strip](
+        state, in, in_len, out
+    );
+}
+
+void trim_finish(struct TrimState* state, struct TrimBuffer* out) {
+    trim_reserve(out, 4);
+    if(state->pending_cr) {
+        state->pending_cr = false;
+        write_newline(
+            state, out, CR, state->newline_type, state->trailing_newline,
+            state->strip
+        );
+    }
+
+    // Handle trailing whitespace at end of file
+    if(state->pending_whitespace > 0) {
+        out->len -= state->pending_whitespace;
+        state->stripped += state->pending_whitespace;
+        state->pending_whitespace = 0;
+        record_change(state, out, 0);
+    }
+
+    // Handle trailing newlines
+    if(state->trailing_newline) {
+        if(state->pending_newline > 0) {
+            // Keep only the first newline sequence of the run. As in
+            // trim_file(), a CR followed by an LF is treated as a CRLF here
+            // even if whitespace between the two was stripped.
+            const uint8_t* run = out->data + out->len - state->pending_newline;
+            size_t keep_len = 1;
+            if(run[0] == '\r' && state->pending_newline > 1 &&
+                    run[1] == '\n') {
+                keep_len = 2;
+            }
+            if(state->pending_newline > keep_len) {
+                // Count the newline sequences removed
+                for(size_t i = keep_len; i < state->pending_newline; ++i) {
+                    if(run[i] == '\r' && i + 1 < state->pending_newline &&
+                            run[i + 1] == '\n') {
+                        ++i;
+                    }
+                    ++state->newlines_removed;
+                }
+                out->len -= state->pending_newline - keep_len;
+                record_change(state, out, 0);
+            }
+            state->pending_newline = 0;
+        } else {
+            // Add trailing newline when none exist
+            enum NewlineType trailing_newline_type = state->newline_type;
+            if(trailing_newline_type == KEEP) {
+                trailing_newline_type = trim_common_newline(state);
+            }
+            record_change(state, out, 0);
+            state->newline_added = true;
+            if(trailing_newline_type == LF) {
+                out->data[out->len++] = '\n';
+            } else if(trailing_newline_type == CRLF) {
+                out->data[out->len++] = '\r';
+                out->data[out->len++] = '\n';
+            } else {
+                out->data[out->len++] = '\r';
+            }
+        }
+    }
+}
+
+enum NewlineType trim_common_newline(const struct TrimState* state) {
+    // Choose best newline format, preferring LF, followed by CRLF
+    if(state->num_lf >= state->num_crlf && state->num_lf >= state->num_cr) {
+        return LF;
+    } else if(state->num_crlf >= state->num_lf &&
+            state->num_crlf >= state->num_cr) {
+        return CRLF;
+    }
+    return CR;
+}
+
+size_t trim_decided(const struct TrimState* state,
+                    const struct TrimBuffer* out) {
+    return out->len - state->pending_newline - state->pending_whitespace;
+}
+
+void trim_release(struct TrimState* state, struct TrimBuffer* out,
+                  size_t len) {
+    memmove(out->data, out->data + len, out->len - len);
+    out->len -= len;
+    state->flushed += len;
+}
+
+uint64_t trim_clock(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 +
+        (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 /
+        frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif // _WIN32
+}
+
+void trim_lap(struct TrimStats* stats, enum TrimPhase phase, uint64_t* mark) {
+    if(stats == NULL) {
+        return;
+    }
+    uint64_t now = trim_clock();
+    stats->phase_ns[phase] += now - *mark;
+    *mark = now;
+}
+
+void trim_tally(struct TrimStats* stats, const struct TrimState* state) {
+    if(stats == NULL) {
+        return;
+    }
+    stats->num_lf += state->num_lf;
+    stats->num_crlf += state->num_crlf;
+    stats->num_cr += state->num_cr;
+    stats->stripped += state->stripped;
+    stats->newlines_removed += state->newlines_removed;
+    stats->newlines_added += state->newline_added;
+}
+
+void trim_stats_add(struct TrimStats* stats, const struct TrimStats* from) {
+    stats->bytes_read += from->bytes_read;
+    stats->bytes_written += from->bytes_written;
+    stats->num_lf += from->num_lf;
+    stats->num_crlf += from->num_crlf;
+    stats->num_cr += from->num_cr;
+    stats->stripped += from->stripped;
+    stats->newlines_removed += from->newlines_removed;
+    stats->newlines_added += from->newlines_added;
+    for(size_t i = 0; i < TRIM_NUM_PHASES; ++i) {
+        stats->phase_ns[i] += from->phase_ns[i];
+    }
+}
+
+/* Pushes the 'len' bytes at 'in' through 'stream', writing the output decided
+to 'out_file' as it goes, and growing 'out' whenever it fills up with undecided
+output. If 'out_file' is NULL, nothing is written and this stops at the first
+change. Returns the number of bytes consumed. */
+static size_t push_all(struct NewlineStream* stream, const uint8_t* in,
+                       size_t len, FILE* out_file, struct TrimBuffer* out,
+                       struct TrimStats* stats, uint64_t* mark) {
+    size_t offset = 0;
+    while(offset < len) {
+        struct NewlineSpan span;
+        size_t used = newline_push(
+            stream, in + offset, len - offset, out->data, out->capacity, &span
+        );
+        offset += used;
+        trim_lap(stats, TRIM_TRANSFORM, mark);
+        if(out_file == NULL) {
+            if(newline_changed(stream)) {
+                break;
+            }
+        } else if(span.len) {
+            fwrite(span.data, 1, span.len, out_file);
+            trim_lap(stats, TRIM_WRITE, mark);
+        }
+        if(!used && !span.len) {
+            out->len = newline_held(stream);
+            trim_reserve(out, 2 * TrimBlockLen + NEWLINE_OUT_EXTRA);
+        }
+    }
+    return offset;
+}
+
+/* Finishes 'stream', writing the rest of the output to 'out_file' unless it's
+NULL, then adds to 'stats' */
+static void finish_all(struct NewlineStream* stream, FILE* out_file,
+                       struct TrimBuffer* out, uint64_t bytes_read,
+                       struct TrimStats* stats, uint64_t* mark) {
+    if(out_file != NULL || !newline_changed(stream)) {
+        struct NewlineSpan span;
+        while(!newline_finish(stream, out->data, out->capacity, &span)) {
+            out->len = newline_held(stream);
+            trim_reserve(out, NEWLINE_OUT_EXTRA);
+        }
+        trim_lap(stats, TRIM_TRANSFORM, mark);
+        if(out_file != NULL) {
+            fwrite(span.data, 1, span.len, out_file);
+            trim_lap(stats, TRIM_WRITE, mark);
+        }
+    }
+    if(stats != NULL) {
+        stats->bytes_read += bytes_read;
+        if(out_file != NULL) {
+            stats->bytes_written += stream->state.flushed +
+                newline_held(stream);
+        }
+        trim_tally(stats, &stream->state);
+    }
+}
+
+bool trim_stream(FILE* in_file, FILE* out_file, struct TrimBuffer* in,
+                 struct TrimBuffer* out, enum NewlineType newline_type,
+                 bool trailing_newline, bool strip, struct TrimStats* stats) {
+    struct NewlineStream stream;
+    newline_init(&stream, newline_type, trailing_newline, strip);
+    in->len = 0;
+    trim_reserve(in, TrimBlockLen);
+    out->len = 0;
+    trim_reserve(out, 2 * TrimBlockLen + NEWLINE_OUT_EXTRA);
+
+    uint64_t bytes_read = 0;
+    uint64_t mark = trim_lap_start(stats);
+    size_t read_len = fread(in->data, 1, TrimBlockLen, in_file);
+    trim_lap(stats, TRIM_READ, &mark);
+    while(read_len) {
+        bytes_read += read_len;
+        push_all(&stream, in->data, read_len, out_file, out, stats, &mark);
+        if(out_file == NULL && newline_changed(&stream)) {
+            break;
+        }
+        read_len = fread(in->data, 1, TrimBlockLen, in_file);
+        trim_lap(stats, TRIM_READ, &mark);
+    }
+    finish_all(&stream, out_file, out, bytes_read, stats, &mark);
+    return newline_changed(&stream);
+}
+
+bool trim_memory(const uint8_t* in, size_t in_len, FILE* out_file,
+                 struct TrimBuffer* out, enum NewlineType newline_type,
+                 bool trailing_newline, bool strip, struct TrimStats* stats) {
+    struct NewlineStream stream;
+    newline_init(&stream, newline_type, trailing_newline, strip);
+    // The input is still consumed a block at a time, as that's all the output
+    // buffer has room for, so it stays small
+    out->len = 0;
+    trim_reserve(out, 2 * TrimBlockLen + NEWLINE_OUT_EXTRA);
+
+    uint64_t mark = trim_lap_start(stats);
+    size_t bytes_read = push_all(
+        &stream, in, in_len, out_file, out, stats, &mark
+    );
+    finish_all(&stream, out_file, out, bytes_read, stats, &mark);
+    return newline_changed(&stream);
+}
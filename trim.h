@@ -2,8 +2,44 @@
 #define NEWLINE_TRIM_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
-#include "args.h"
+#include <sys/types.h>
+#include "libnewline.h"
+
+/* Length of the blocks read from the input by trim_stream() (1 MiB) */
+static const size_t TrimBlockLen = 1024*1024;
+
+/* Growable output buffer written to by trim_block() and trim_finish(). */
+struct TrimBuffer {
+    uint8_t* data;
+    size_t len;
+    size_t capacity;
+};
+
+/* Phases of processing a file which are timed separately */
+enum TrimPhase {
+    TRIM_READ,
+    TRIM_TRANSFORM,
+    TRIM_WRITE,
+    TRIM_NUM_PHASES
+};
+
+/* Statistics about processing a file, or several files added together. The
+functions below which take a TrimStats add to it if it isn't NULL. */
+struct TrimStats {
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t num_lf;            // Newlines of each type read
+    uint64_t num_crlf;
+    uint64_t num_cr;
+    uint64_t stripped;          // Bytes of trailing whitespace removed
+    uint64_t newlines_removed;  // Excess trailing newlines removed
+    uint64_t newlines_added;    // Trailing newlines added
+    // Time spent in each phase, in nanoseconds
+    uint64_t phase_ns[TRIM_NUM_PHASES];
+};
 
 /* Processes 'in_file', writing the result to 'out_file'. Requires that
 'in_file' be opened for reading in binary mode, and 'out_file' be opened for
@@ -29,4 +65,83 @@ consecutive space or tab characters. */
 bool trim_file(FILE* in_file, FILE* out_file, enum NewlineType newline_type,
                bool trailing_newline, bool strip);
 
+/* Grows 'buffer' if needed so it has room for at least 'len' more bytes. */
+void trim_reserve(struct TrimBuffer* buffer, size_t len);
+
+/* Initialises 'state' for processing a new file with the given options, which
+have the same meaning as for trim_file(). */
+void trim_init(struct TrimState* state, enum NewlineType newline_type,
+               bool trailing_newline, bool strip);
+
+/* Processes the next 'in_len' bytes of the file, appending the result to
+'out'. Blocks may be of any size, and CRLF pairs or runs of whitespace may
+span several blocks. */
+void trim_block(struct TrimState* state, const uint8_t* in, size_t in_len,
+                struct TrimBuffer* out);
+
+/* Processes the end of the file, appending the result to 'out'. Every byte of
+'out' is decided once this returns. */
+void trim_finish(struct TrimState* state, struct TrimBuffer* out);
+
+/* Returns the most common type of newline counted by 'state', preferring LF,
+followed by CRLF. This is the type of trailing newline added with KEEP. */
+enum NewlineType trim_common_newline(const struct TrimState* state);
+
+/* Returns the number of bytes at the start of 'out' which are decided and
+will never change. */
+size_t trim_decided(const struct TrimState* state,
+                    const struct TrimBuffer* out);
+
+/* Removes the first 'len' decided bytes from 'out', once the caller has
+written them elsewhere. */
+void trim_release(struct TrimState* state, struct TrimBuffer* out,
+                  size_t len);
+
+/* Returns true if the output differs from the input so far. */
+static inline bool trim_changed(const struct TrimState* state) {
+    return state->first_change != -1;
+}
+
+/* Returns the time in nanoseconds from an arbitrary starting point, which
+never goes backwards. */
+uint64_t trim_clock(void);
+
+/* Returns the time to start timing phases from, or 0 if 'stats' is NULL, in
+which case nothing is timed. */
+static inline uint64_t trim_lap_start(const struct TrimStats* stats) {
+    return stats != NULL ? trim_clock() : 0;
+}
+
+/* Adds the time since 'mark' to 'phase' of 'stats', then moves 'mark' to
+now. Does nothing if 'stats' is NULL. */
+void trim_lap(struct TrimStats* stats, enum TrimPhase phase, uint64_t* mark);
+
+/* Adds the newlines counted and changes made by 'state' to 'stats', if it
+isn't NULL. */
+void trim_tally(struct TrimStats* stats, const struct TrimState* state);
+
+/* Adds everything in 'from' to 'stats'. */
+void trim_stats_add(struct TrimStats* stats, const struct TrimStats* from);
+
+/* Same as trim_file(), but processes 'in_file' in large blocks and writes
+'out_file' sequentially, without seeking either file. 'out_file' only needs to
+be opened for writing. The output is identical to that of trim_file().
+
+If 'out_file' is NULL, nothing is written and reading stops at the first block
+containing a change, which is enough to determine the return value.
+
+Blocks are read into 'in', and output is held in 'out' until it's written.
+Both are kept rather than freed, so they can be reused for the next file
+without allocating again, and may start out empty. */
+bool trim_stream(FILE* in_file, FILE* out_file, struct TrimBuffer* in,
+                 struct TrimBuffer* out, enum NewlineType newline_type,
+                 bool trailing_newline, bool strip, struct TrimStats* stats);
+
+/* Same as trim_stream(), but reads the file from the 'in_len' bytes at 'in',
+such as a memory mapping of the file. Reading a memory mapping happens as it's
+processed, so is timed as part of TRIM_TRANSFORM. */
+bool trim_memory(const uint8_t* in, size_t in_len, FILE* out_file,
+                 struct TrimBuffer* out, enum NewlineType newline_type,
+                 bool trailing_newline, bool strip, struct TrimStats* stats);
+
 #endif // NEWLINE_TRIM_H
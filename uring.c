@@ -0,0 +1,377 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "inplace.h"
+#include "trim.h"
+#include "uring.h"
+
+/* Operations a file may have in flight, encoded in the user data of each
+request along with the index of the file */
+enum UringOp {
+    URING_OP_OPEN,
+    URING_OP_READ,
+    URING_OP_WRITE,
+    URING_OP_CLOSE,
+    URING_NUM_OPS
+};
+
+/* Room in the ring for two operations on each file of a batch */
+static const unsigned UringEntries = 2 * URING_BATCH_LEN;
+
+struct Uring {
+    int fd;
+    // Submission queue, shared with the kernel
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned sq_pending_tail;   // Tail including requests not yet submitted
+    // Completion queue, shared with the kernel
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    size_t sq_map_len;
+    void* cq_map;
+    size_t cq_map_len;
+    size_t sqes_len;
+    unsigned in_flight;         // Requests which haven't completed yet
+    unsigned file_in_flight[URING_BATCH_LEN];  // Same for each file
+    size_t max_len;             // Length of the largest file to read
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params* params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                       unsigned flags) {
+    return syscall(
+        __NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0
+    );
+}
+
+static int uring_register(int fd, unsigned opcode, void* arg,
+                          unsigned num_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, num_args);
+}
+
+/* Returns true if the kernel behind 'ring' supports every operation used */
+static bool uring_probe(const struct Uring* ring) {
+    static const uint8_t needed[] = {
+        IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE,
+        IORING_OP_CLOSE
+    };
+    size_t probe_len = sizeof(struct io_uring_probe) +
+        256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, probe_len);
+    bool supported = !uring_register(
+        ring->fd, IORING_REGISTER_PROBE, probe, 256
+    );
+    for(size_t i = 0; supported && i < sizeof(needed); ++i) {
+        supported = needed[i] <= probe->last_op &&
+            (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+struct Uring* uring_open(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = uring_setup(UringEntries, &params);
+    if(fd < 0) {
+        return NULL;
+    }
+    struct Uring* ring = calloc(1, sizeof(struct Uring));
+    ring->fd = fd;
+    ring->sq_map = MAP_FAILED;
+    ring->cq_map = MAP_FAILED;
+    ring->sqes = MAP_FAILED;
+    ring->sq_map_len = params.sq_off.array + params.sq_entries *
+        sizeof(unsigned);
+    ring->cq_map_len = params.cq_off.cqes + params.cq_entries *
+        sizeof(struct io_uring_cqe);
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_map && ring->cq_map_len > ring->sq_map_len) {
+        ring->sq_map_len = ring->cq_map_len;
+    }
+    ring->sq_map = mmap(
+        NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING
+    );
+    if(single_map) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(
+            NULL, ring->cq_map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING
+        );
+    }
+    ring->sqes = mmap(
+        NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES
+    );
+    if(ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED ||
+            ring->sqes == MAP_FAILED || params.sq_entries < UringEntries ||
+            !uring_probe(ring)) {
+        uring_close(ring);
+        return NULL;
+    }
+
+    uint8_t* sq = ring->sq_map;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->sq_pending_tail = *ring->sq_tail;
+    uint8_t* cq = ring->cq_map;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+void uring_close(struct Uring* ring) {
+    if(ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if(ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_len);
+    }
+    if(ring->sq_map != MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_map_len);
+    }
+    close(ring->fd);
+    free(ring);
+}
+
+/* Queues a request for operation 'op' on file 'index', returning it for the
+caller to fill in */
+static struct io_uring_sqe* uring_queue(struct Uring* ring, size_t index,
+                                        enum UringOp op) {
+    unsigned slot = ring->sq_pending_tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[slot];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->user_data = index * URING_NUM_OPS + op;
+    ring->sq_array[slot] = slot;
+    ++ring->sq_pending_tail;
+    ++ring->in_flight;
+    ++ring->file_in_flight[index];
+    return sqe;
+}
+
+/* Submits the requests queued, then calls 'complete' with each completion
+until every request has completed, including any queued by 'complete'. If the
+ring stops working, every file with requests still in flight fails with the
+error, and false is returned. */
+static bool uring_wait(struct Uring* ring, struct UringFile* files,
+                       void (*complete)(struct Uring* ring,
+                                        struct UringFile* files, size_t index,
+                                        enum UringOp op, int result)) {
+    while(ring->in_flight) {
+        __atomic_store_n(
+            ring->sq_tail, ring->sq_pending_tail, __ATOMIC_RELEASE
+        );
+        unsigned to_submit = ring->sq_pending_tail -
+            __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if(uring_enter(ring->fd, to_submit, 1, IORING_ENTER_GETEVENTS) < 0 &&
+                errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            // Nothing more will complete, so there's no telling whether the
+            // requests in flight happened or not
+            for(size_t i = 0; i < URING_BATCH_LEN; ++i) {
+                if(ring->file_in_flight[i]) {
+                    files[i].error = errno;
+                    files[i].fd = -1;
+                    ring->file_in_flight[i] = 0;
+                }
+            }
+            ring->in_flight = 0;
+            return false;
+        }
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != tail; ++head) {
+            const struct io_uring_cqe* cqe =
+                &ring->cqes[head & *ring->cq_mask];
+            size_t index = cqe->user_data / URING_NUM_OPS;
+            enum UringOp op = cqe->user_data % URING_NUM_OPS;
+            int result = cqe->res;
+            // Release the entry before handling it, as handling it may queue
+            // more requests
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            --ring->in_flight;
+            --ring->file_in_flight[index];
+            complete(ring, files, index, op, result);
+        }
+    }
+    return true;
+}
+
+/* Queues closing file 'index' */
+static void queue_close(struct Uring* ring, struct UringFile* files,
+                        size_t index) {
+    struct io_uring_sqe* sqe = uring_queue(ring, index, URING_OP_CLOSE);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = files[index].fd;
+}
+
+/* Queues reading the rest of file 'index', and the byte after the end it was
+stat'd with, to see if it has grown */
+static void queue_read(struct Uring* ring, struct UringFile* files,
+                       size_t index) {
+    struct UringFile* file = &files[index];
+    struct io_uring_sqe* sqe = uring_queue(ring, index, URING_OP_READ);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = file->fd;
+    sqe->addr = (uintptr_t)(file->in.data + file->in.len);
+    sqe->len = file->stat.st_size + 1 - file->in.len;
+    sqe->off = file->in.len;
+}
+
+/* Handles the result of an operation queued by uring_open_read() */
+static void complete_open_read(struct Uring* ring, struct UringFile* files,
+                               size_t index, enum UringOp op, int result) {
+    struct UringFile* file = &files[index];
+    if(op == URING_OP_CLOSE) {
+        file->fd = -1;
+        return;
+    } else if(op == URING_OP_READ) {
+        if(result < 0) {
+            file->error = -result;
+            queue_close(ring, files, index);
+            return;
+        }
+        // Reads may be cut short, such as on network filesystems, so the
+        // rest is read until the file ends. A file which has grown or
+        // shrunk since it was stat'd is left to be read as usual.
+        file->in.len += result;
+        if((off_t)file->in.len == file->stat.st_size) {
+            file->read = true;
+        } else if(result && (off_t)file->in.len < file->stat.st_size) {
+            queue_read(ring, files, index);
+        }
+        return;
+    } else if(result < 0) {
+        file->error = -result;
+        return;
+    }
+
+    file->fd = result;
+    if(!file->stat_done) {
+        // io_uring always hands statx() to a worker thread, which takes far
+        // longer than fstat() of the open file
+        file->stat_done = !fstat(file->fd, &file->stat);
+        if(!file->stat_done) {
+            file->error = errno;
+        }
+    }
+    if(!file->error && S_ISDIR(file->stat.st_mode)) {
+        file->error = EISDIR;
+    }
+    if(file->error) {
+        queue_close(ring, files, index);
+    } else if(S_ISREG(file->stat.st_mode) &&
+            (uintmax_t)file->stat.st_size < ring->max_len) {
+        queue_read(ring, files, index);
+    }
+}
+
+bool uring_open_read(struct Uring* ring, struct UringFile* files,
+                     size_t num_files, size_t max_len) {
+    ring->max_len = max_len;
+    for(size_t i = 0; i < num_files; ++i) {
+        struct UringFile* file = &files[i];
+        file->fd = -1;
+        file->read = false;
+        if(file->skip || file->error) {
+            continue;
+        }
+        // Room to read files smaller than 'max_len', and the byte after
+        file->in.len = 0;
+        trim_reserve(&file->in, max_len);
+        struct io_uring_sqe* sqe = uring_queue(ring, i, URING_OP_OPEN);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t)file->name;
+        sqe->open_flags = (file->write ? O_RDWR : O_RDONLY) | O_CLOEXEC;
+    }
+    return uring_wait(ring, files, complete_open_read);
+}
+
+/* Handles the result of an operation queued by uring_write_close() */
+static void complete_write_close(struct Uring* ring, struct UringFile* files,
+                                 size_t index, enum UringOp op, int result) {
+    (void)ring;
+    struct UringFile* file = &files[index];
+    if(op == URING_OP_WRITE) {
+        if(result > 0) {
+            file->write_data += result;
+            file->write_len -= result;
+            file->write_offset += result;
+        } else if(result < 0) {
+            file->error = -result;
+        }
+    } else if(result == -ECANCELED) {
+        // A failed or short write cancels the close linked to it, so finish
+        // both here
+        FILE* stream = file->error ? NULL : fdopen(file->fd, "r+b");
+        if(stream != NULL) {
+            if(!write_file_at(
+                    stream, file->write_data, file->write_len,
+                    file->write_offset)) {
+                file->error = errno;
+            }
+            fclose(stream);
+        } else {
+            close(file->fd);
+        }
+        file->fd = -1;
+    } else {
+        file->fd = -1;
+    }
+}
+
+bool uring_write_close(struct Uring* ring, struct UringFile* files,
+                       size_t num_files) {
+    for(size_t i = 0; i < num_files; ++i) {
+        struct UringFile* file = &files[i];
+        if(file->fd == -1) {
+            continue;
+        }
+        if(file->write_len) {
+            struct io_uring_sqe* sqe = uring_queue(ring, i, URING_OP_WRITE);
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->fd = file->fd;
+            sqe->addr = (uintptr_t)file->write_data;
+            sqe->len = file->write_len;
+            sqe->off = file->write_offset;
+        }
+        queue_close(ring, files, i);
+    }
+    if(uring_wait(ring, files, complete_write_close)) {
+        return true;
+    }
+    for(size_t i = 0; i < num_files; ++i) {
+        // Files whose output was all written only had closing in flight
+        if(!files[i].write_len) {
+            files[i].error = 0;
+        }
+    }
+    return false;
+}
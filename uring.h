@@ -0,0 +1,67 @@
+#ifndef NEWLINE_URING_H
+#define NEWLINE_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "trim.h"
+
+/* Most files handled by each call below, which the ring has room for */
+#define URING_BATCH_LEN 32
+
+/* An io_uring instance, for opening, reading, writing and closing many files
+with a few system calls */
+struct Uring;
+
+/* A file handled as part of a batch, and the outcome of each step. Buffers
+are kept between batches, so an array of these can be reused without
+allocating again. Initialise with zeros. */
+struct UringFile {
+    const char* name;
+    bool write;              // Open the file for writing as well as reading
+    bool skip;               // Leave the file out of the steps still to come
+    bool stat_done;          // Whether or not 'stat' has been filled in
+    int fd;                  // Descriptor of the file, or -1 if not open
+    int error;               // Value of errno if a step failed, else 0
+    struct stat stat;        // Type, size, times and identity of the file
+    bool read;               // Whether or not 'in' holds the whole file
+    struct TrimBuffer in;    // Contents of the file
+    struct TrimBuffer out;   // Space for the caller to process the file into
+    const uint8_t* write_data;  // Written at 'write_offset' before closing
+    size_t write_len;
+    off_t write_offset;
+};
+
+/* Returns a ring for handling batches of up to URING_BATCH_LEN files, or NULL
+if io_uring isn't available or can't open, read, write and close files,
+such as on kernels before 5.6, or where it's disabled by sysctl or a seccomp
+filter. Files should then be handled one at a time with ordinary system
+calls. */
+struct Uring* uring_open(void);
+
+/* Releases 'ring' */
+void uring_close(struct Uring* ring);
+
+/* Opens each of the 'num_files' files which isn't skipped and has no error,
+then fills in 'stat' if it wasn't already. Each regular file smaller than
+'max_len' bytes is then read whole into 'in', setting 'read', which is left
+false if its size changes meanwhile. Directories fail with EISDIR, as they
+can't be processed. Files which are left open without being read, such as
+large files, can be processed through their descriptor as usual.
+
+Returns false if the ring stops working. Files with requests in flight then
+fail with the error, may be left open, and have 'fd' set to -1. The ring must
+then be closed, and the other files processed without it. */
+bool uring_open_read(struct Uring* ring, struct UringFile* files,
+                     size_t num_files, size_t max_len);
+
+/* Writes 'write_len' bytes of 'write_data' to each of the 'num_files' files
+still open, then closes them. Files which can't be written fail with the
+error, and may be left partly written. Returns false if the ring stops
+working, as for uring_open_read(), with files still to be written failing. */
+bool uring_write_close(struct Uring* ring, struct UringFile* files,
+                       size_t num_files);
+
+#endif // NEWLINE_URING_H
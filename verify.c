@@ -0,0 +1,492 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef __linux__
+    #include <sys/mman.h>
+#endif // __linux__
+#include "args.h"
+#include "inplace.h"
+#include "libnewline.h"
+#include "pipeline.h"
+#include "scan.h"
+#include "trim.h"
+#include "verify.h"
+#ifdef __linux__
+    #include "parallel.h"
+#endif // __linux__
+
+/* Inputs no larger than this are also pushed through the streaming API in
+chunks of a few bytes, splitting them at every possible point, and through
+pipelines with blocks as small (16 KiB). Larger inputs would take seconds. */
+static const size_t VerifyTinyChunksMax = 16*1024;
+
+/* Lengths of the chunks small inputs are pushed through the streaming API in,
+besides a page at a time and all at once */
+static const size_t VerifyTinyChunkLens[] = {1, 2, 3, 7};
+
+#ifdef __linux__
+/* Most threads trim_parallel() is run with when chunks may be as small as a
+single byte, which is also the most chunks inputs are split into */
+static const size_t VerifyTinyChunksThreads = 3;
+#endif // __linux__
+
+/* Names of each NewlineType, for reporting differences */
+static const arg_char* const VerifyTypeNames[] = {
+    arg_s("lf"), arg_s("crlf"), arg_s("cr"), arg_s("keep")
+};
+
+/* An input, and what trim_file() makes of it */
+struct Verify {
+    const arg_char* name;
+    const uint8_t* in;
+    size_t len;
+    const struct Arguments* args;
+    uint8_t* expected;
+    size_t expected_len;
+    bool expected_changed;
+    const char* kernel;  // Scan kernel used, if not the one picked at startup
+};
+
+uint8_t* verify_read(FILE* file, size_t* len) {
+#ifdef _WIN32
+    struct _stat64 file_stat;
+    if(_fstat64(_fileno(file), &file_stat) ||
+            !(file_stat.st_mode & _S_IFREG)) {
+        return NULL;
+    }
+#else
+    struct stat file_stat;
+    if(fstat(fileno(file), &file_stat) || !S_ISREG(file_stat.st_mode)) {
+        return NULL;
+    }
+#endif // _WIN32
+    struct TrimBuffer buffer = {NULL, 0, 0};
+    trim_reserve(&buffer, file_stat.st_size + 1);
+    size_t read_len;
+    do {
+        trim_reserve(&buffer, TrimBlockLen);
+        read_len = fread(buffer.data + buffer.len, 1, TrimBlockLen, file);
+        buffer.len += read_len;
+    } while(read_len);
+    if(ferror(file) || fseeko(file, 0, SEEK_SET)) {
+        free(buffer.data);
+        return NULL;
+    }
+    *len = buffer.len;
+    return buffer.data;
+}
+
+/* Returns a temporary file containing the 'len' bytes at 'data', with its
+position at the start */
+static FILE* temp_with(const uint8_t* data, size_t len) {
+    FILE* file = tmpfile();
+    if(file == NULL) {
+        arg_printerr(arg_s("verify: can't create a temporary file"));
+        abort();
+    }
+    fwrite(data, 1, len, file);
+    fflush(file);
+    fseeko(file, 0, SEEK_SET);
+    return file;
+}
+
+/* Compares the 'out_len' bytes at 'out' and 'changed', the result of
+'engine', with those of trim_file(). If 'out' is NULL, only 'changed' is
+compared. 'chunk_len' is the length of the chunks the input was given in, if
+not 0. Aborts if they differ. */
+static void compare(const struct Verify* verify, const arg_char* engine,
+                    size_t chunk_len, const uint8_t* out, size_t out_len,
+                    bool changed) {
+    size_t offset = 0;
+    bool same = changed == verify->expected_changed;
+    if(same && out != NULL) {
+        size_t min_len = out_len < verify->expected_len ?
+            out_len : verify->expected_len;
+        while(offset < min_len && out[offset] == verify->expected[offset]) {
+            ++offset;
+        }
+        same = out_len == verify->expected_len && offset == out_len;
+    }
+    if(same) {
+        return;
+    }
+    arg_printerr(
+        arg_s("verify: ") arg_f arg_s(": ") arg_f
+        arg_s(" differs from trim_file() with -t ") arg_f arg_f arg_f,
+        verify->name, engine, VerifyTypeNames[verify->args->newline_type],
+        verify->args->trailing_newline ? arg_s("") : arg_s(" -N"),
+        verify->args->strip_whitespace ? arg_s("") : arg_s(" -S")
+    );
+    if(chunk_len) {
+        arg_printerr(
+            arg_s("verify: input given in chunks of %llu bytes"),
+            (unsigned long long)chunk_len
+        );
+    }
+    if(verify->kernel != NULL) {
+        arg_char kernel[16] = {0};
+        for(size_t i = 0; i < 15 && verify->kernel[i]; ++i) {
+            kernel[i] = verify->kernel[i];
+        }
+        arg_printerr(
+            arg_s("verify: scanned with the ") arg_f arg_s(" kernel"), kernel
+        );
+    }
+    if(changed != verify->expected_changed) {
+        arg_printerr(
+            arg_s("verify: reported ") arg_f arg_s(", expected ") arg_f,
+            changed ? arg_s("changed") : arg_s("unchanged"),
+            verify->expected_changed ? arg_s("changed") : arg_s("unchanged")
+        );
+    } else {
+        arg_printerr(
+            arg_s("verify: output of %llu bytes, expected %llu, first ")
+            arg_s("difference at offset %llu"), (unsigned long long)out_len,
+            (unsigned long long)verify->expected_len,
+            (unsigned long long)offset
+        );
+    }
+    abort();
+}
+
+/* Same as compare(), but compares the whole of 'file', then closes it. If
+'file' is NULL, only 'changed' is compared. */
+static void compare_file(const struct Verify* verify, const arg_char* engine,
+                         FILE* file, bool changed) {
+    if(file == NULL) {
+        compare(verify, engine, 0, NULL, 0, changed);
+        return;
+    }
+    fflush(file);
+    fseeko(file, 0, SEEK_SET);
+    size_t out_len = 0;
+    uint8_t* out = verify_read(file, &out_len);
+    if(out == NULL) {
+        arg_printerr(arg_s("verify: can't read a temporary file"));
+        abort();
+    }
+    compare(verify, engine, 0, out, out_len, changed);
+    free(out);
+    fclose(file);
+}
+
+/* Pushes the input through the streaming API in chunks of 'chunk_len' bytes,
+with an output buffer of 'capacity' bytes which only grows when it fills up
+with undecided output */
+static void verify_push(const struct Verify* verify, size_t chunk_len,
+                        size_t capacity) {
+    const struct Arguments* args = verify->args;
+    struct NewlineStream stream;
+    newline_init(
+        &stream, args->newline_type, args->trailing_newline,
+        args->strip_whitespace
+    );
+    struct TrimBuffer out = {NULL, 0, 0};
+    uint8_t* buffer = malloc(capacity);
+    struct NewlineSpan span;
+    size_t offset = 0;
+    while(offset < verify->len) {
+        size_t len = verify->len - offset;
+        if(len > chunk_len) {
+            len = chunk_len;
+        }
+        size_t used = newline_push(
+            &stream, verify->in + offset, len, buffer, capacity, &span
+        );
+        offset += used;
+        trim_reserve(&out, span.len);
+        memcpy(out.data + out.len, span.data, span.len);
+        out.len += span.len;
+        if(!used && !span.len) {
+            capacity = capacity * 2 + 1;
+            buffer = realloc(buffer, capacity);
+        }
+    }
+    while(!newline_finish(&stream, buffer, capacity, &span)) {
+        capacity = capacity * 2 + 1;
+        buffer = realloc(buffer, capacity);
+    }
+    trim_reserve(&out, span.len);
+    memcpy(out.data + out.len, span.data, span.len);
+    out.len += span.len;
+    compare(
+        verify, arg_s("newline_push()"), chunk_len, out.data, out.len,
+        newline_changed(&stream)
+    );
+    free(out.data);
+    free(buffer);
+}
+
+#ifdef __linux__
+/* Maps the first 'len' bytes of 'file' for reading, or returns NULL if 'len'
+is 0, which can't be mapped */
+static const uint8_t* map_temp(FILE* file, size_t len) {
+    if(!len) {
+        return NULL;
+    }
+    void* map = mmap(NULL, len, PROT_READ, MAP_SHARED, fileno(file), 0);
+    if(map == MAP_FAILED) {
+        arg_printerr(arg_s("verify: can't map a temporary file"));
+        abort();
+    }
+    return map;
+}
+
+/* Runs trim_parallel() with 'num_threads' threads and chunks of at least
+'chunk_min' bytes, writing a new file, checking only, and rewriting a file in
+place */
+static void verify_parallel(const struct Verify* verify,
+                            struct Scratch* scratch, size_t num_threads,
+                            size_t chunk_min) {
+    const struct Arguments* args = verify->args;
+    for(int check = 0; check < 2; ++check) {
+        FILE* out_file = check ? NULL : tmpfile();
+        bool result = trim_parallel(
+            NULL, verify->name, out_file, verify->in, verify->len,
+            num_threads, chunk_min, scratch, args->newline_type,
+            args->trailing_newline, args->strip_whitespace, NULL
+        );
+        if(out_file != NULL && !result) {
+            // Nothing is written if there are no changes
+            fclose(out_file);
+            out_file = NULL;
+        }
+        compare_file(verify, arg_s("trim_parallel()"), out_file, result);
+    }
+    if(verify->len) {
+        FILE* file = temp_with(verify->in, verify->len);
+        const uint8_t* map = map_temp(file, verify->len);
+        bool result = trim_parallel(
+            file, verify->name, NULL, map, verify->len, num_threads,
+            chunk_min, scratch, args->newline_type, args->trailing_newline,
+            args->strip_whitespace, NULL
+        );
+        munmap((void*)map, verify->len);
+        compare_file(verify, arg_s("trim_parallel() in place"), file, result);
+    }
+}
+#endif // __linux__
+
+/* Fills in the output of trim_file() for the input of 'verify', the contents
+of 'in_file' */
+static void verify_expect(struct Verify* verify, FILE* in_file) {
+    const struct Arguments* args = verify->args;
+    FILE* out_file = tmpfile();
+    verify->expected_changed = trim_file(
+        in_file, out_file, args->newline_type, args->trailing_newline,
+        args->strip_whitespace
+    );
+    fseeko(out_file, 0, SEEK_SET);
+    verify->expected = verify_read(out_file, &verify->expected_len);
+    fclose(out_file);
+}
+
+/* Runs the 'len' bytes at 'in' through every engine, as for verify_engines().
+If 'changed' isn't NULL, it's compared as well. */
+static void verify_run(const arg_char* name, const uint8_t* in, size_t len,
+                       const struct Arguments* args, const bool* changed) {
+    enum NewlineType type = args->newline_type;
+    bool trailing = args->trailing_newline;
+    bool strip = args->strip_whitespace;
+    struct Verify verify = {
+        .name = name,
+        .in = in,
+        .len = len,
+        .args = args,
+        .kernel = NULL
+    };
+    FILE* in_file = temp_with(in, len);
+    verify_expect(&verify, in_file);
+    FILE* out_file;
+    if(changed != NULL) {
+        compare(
+            &verify, arg_s("the file's processing"), 0, NULL, 0, *changed
+        );
+    }
+
+    struct Scratch scratch = {
+        .in = {NULL, 0, 0},
+        .out = {NULL, 0, 0},
+        .temp = NULL
+    };
+    for(int check = 0; check < 2; ++check) {
+        fseeko(in_file, 0, SEEK_SET);
+        out_file = check ? NULL : tmpfile();
+        bool result = trim_stream(
+            in_file, out_file, &scratch.in, &scratch.out, type, trailing,
+            strip, NULL
+        );
+        compare_file(&verify, arg_s("trim_stream()"), out_file, result);
+
+        out_file = check ? NULL : tmpfile();
+        result = trim_memory(
+            in, len, out_file, &scratch.out, type, trailing, strip, NULL
+        );
+        compare_file(&verify, arg_s("trim_memory()"), out_file, result);
+
+        // Small buffers, so blocks queue up between the stages
+        size_t buffer_len = len <= VerifyTinyChunksMax ? 7 : 4096;
+        fseeko(in_file, 0, SEEK_SET);
+        out_file = check ? NULL : tmpfile();
+        result = trim_pipeline(
+            in_file, NULL, 0, out_file, &scratch, buffer_len, 2, type,
+            trailing, strip, NULL
+        );
+        compare_file(&verify, arg_s("trim_pipeline()"), out_file, result);
+
+        out_file = check ? NULL : tmpfile();
+        result = trim_pipeline(
+            NULL, in, len, out_file, &scratch, buffer_len, 2, type, trailing,
+            strip, NULL
+        );
+        compare_file(
+            &verify, arg_s("trim_pipeline() mapped"), out_file, result
+        );
+
+        if(len < SmallFileMax) {
+            FILE* file = temp_with(in, len);
+            result = trim_small(
+                file, check, &scratch, type, trailing, strip, NULL
+            );
+            if(check) {
+                fclose(file);
+                file = NULL;
+            }
+            compare_file(&verify, arg_s("trim_small()"), file, result);
+        }
+    }
+    fclose(in_file);
+
+    if(len <= VerifyTinyChunksMax) {
+        for(size_t i = 0; i < sizeof(VerifyTinyChunkLens) / sizeof(size_t);
+                ++i) {
+            verify_push(&verify, VerifyTinyChunkLens[i], 0);
+        }
+        verify_push(&verify, 4096, 0);
+    } else {
+        verify_push(&verify, 4096, 2 * 4096 + NEWLINE_OUT_EXTRA);
+    }
+    if(len > 4096) {
+        verify_push(&verify, len, 0);
+    }
+
+    for(int check = 0; check < 2; ++check) {
+        FILE* file = temp_with(in, len);
+        bool result;
+        if(!trim_tail(
+                file, check, NULL, 0, &scratch, type, trailing, strip, NULL,
+                &result)) {
+            fclose(file);
+            continue;
+        }
+        if(check) {
+            fclose(file);
+            file = NULL;
+        }
+        compare_file(&verify, arg_s("trim_tail()"), file, result);
+    }
+
+    FILE* file = temp_with(in, len);
+    bool result = trim_in_place(
+        file, name, NULL, 0, &scratch, type, trailing, strip, NULL
+    );
+    compare_file(&verify, arg_s("trim_in_place()"), file, result);
+#ifdef __linux__
+    file = temp_with(in, len);
+    const uint8_t* map = map_temp(file, len);
+    result = trim_in_place(
+        file, name, map, len, &scratch, type, trailing, strip, NULL
+    );
+    if(map != NULL) {
+        munmap((void*)map, len);
+    }
+    compare_file(&verify, arg_s("trim_in_place() mapped"), file, result);
+
+    file = temp_with(in, len);
+    map = map_temp(file, len);
+    if(trim_tail(
+            file, false, map, len, &scratch, type, trailing, strip, NULL,
+            &result)) {
+        if(map != NULL) {
+            munmap((void*)map, len);
+        }
+        compare_file(&verify, arg_s("trim_tail() mapped"), file, result);
+    } else {
+        if(map != NULL) {
+            munmap((void*)map, len);
+        }
+        fclose(file);
+    }
+
+    // Every thread count the file could be split across, up to a few more
+    // than the chunks it can be split into, then chunks of a single byte or
+    // more, which split even small inputs
+    size_t max_threads = len / ParallelChunkMin + 3;
+    for(size_t num_threads = 2; num_threads <= max_threads; ++num_threads) {
+        verify_parallel(&verify, &scratch, num_threads, ParallelChunkMin);
+    }
+    for(size_t num_threads = 2; num_threads <= VerifyTinyChunksThreads;
+            ++num_threads) {
+        verify_parallel(&verify, &scratch, num_threads, 1);
+    }
+#endif // __linux__
+    scratch_free(&scratch);
+    free(verify.expected);
+}
+
+void verify_engines(const arg_char* name, const uint8_t* in, size_t len,
+                    const struct Arguments* args, bool changed) {
+    verify_run(name, in, len, args, &changed);
+}
+
+void verify_options(const arg_char* name, const uint8_t* in, size_t len,
+                    const struct Arguments* args) {
+    verify_run(name, in, len, args, NULL);
+}
+
+void verify_kernels(const arg_char* name, const uint8_t* in, size_t len,
+                    const struct Arguments* args) {
+    enum NewlineType type = args->newline_type;
+    bool trailing = args->trailing_newline;
+    bool strip = args->strip_whitespace;
+    struct Verify verify = {
+        .name = name,
+        .in = in,
+        .len = len,
+        .args = args,
+        .kernel = NULL
+    };
+    FILE* in_file = temp_with(in, len);
+    verify_expect(&verify, in_file);
+    fclose(in_file);
+
+    const struct ScanKernel* kernels;
+    size_t num_kernels = scan_kernels(&kernels);
+    const uint8_t* (*picked)(const uint8_t*, const uint8_t*) = scan_newline;
+    struct TrimBuffer out = {NULL, 0, 0};
+    for(size_t i = 0; i < num_kernels; ++i) {
+        scan_newline = kernels[i].scan;
+        verify.kernel = kernels[i].name;
+        for(int check = 0; check < 2; ++check) {
+            FILE* out_file = check ? NULL : tmpfile();
+            bool result = trim_memory(
+                in, len, out_file, &out, type, trailing, strip, NULL
+            );
+            compare_file(&verify, arg_s("trim_memory()"), out_file, result);
+        }
+        off_t first_change = trim_whole(
+            in, len, &out, false, type, trailing, strip, NULL
+        );
+        compare(
+            &verify, arg_s("trim_whole()"), 0, out.data, out.len,
+            first_change != -1
+        );
+    }
+    scan_newline = picked;
+    free(out.data);
+    free(verify.expected);
+}
@@ -0,0 +1,42 @@
+#ifndef NEWLINE_VERIFY_H
+#define NEWLINE_VERIFY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "args.h"
+
+/* Checks every engine against trim_file(), the reference implementation, in
+debug builds, and in the tests built by 'make test' and 'make fuzz'. Each
+engine is run over a copy of the input with the options in 'args', in every
+mode it supports (writing a new file, checking only, and rewriting a file in
+place), and with adversarial block boundaries: the streaming API is given
+chunks as small as a single byte, so CRs, CRLF pairs and runs of whitespace or
+newlines are split at every possible point. The output, and whether or not a
+change is reported, must be identical. */
+
+/* Reads the whole of 'file' if it's a regular file, then seeks back to the
+start, setting 'len' to its length. Returns the contents, which the caller
+must free, or NULL if the file isn't a regular file or couldn't be read. */
+uint8_t* verify_read(FILE* file, size_t* len);
+
+/* Runs the 'len' bytes at 'in', the contents of the file 'name' before it was
+processed, through every engine. 'changed' is what the file's processing
+reported. Prints what differs and aborts if any engine's result doesn't match
+that of trim_file(). */
+void verify_engines(const arg_char* name, const uint8_t* in, size_t len,
+                    const struct Arguments* args, bool changed);
+
+/* Same as verify_engines(), for an input which hasn't been processed, so
+there's no result of its own to compare. */
+void verify_options(const arg_char* name, const uint8_t* in, size_t len,
+                    const struct Arguments* args);
+
+/* Checks the block engine against trim_file() with each scan kernel the CPU
+supports, rather than only the one picked at startup. Points scan_newline at
+each in turn, so must not be called while other threads may be scanning. */
+void verify_kernels(const arg_char* name, const uint8_t* in, size_t len,
+                    const struct Arguments* args);
+
+#endif // NEWLINE_VERIFY_H
@@ -0,0 +1,393 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "walk.h"
+
+/* A single pattern from a .gitignore file */
+struct IgnoreRule {
+    char* pattern;
+    bool negate;    // Pattern started with '!'
+    bool dir_only;  // Pattern ended with '/'
+    bool anchored;  // Pattern contained a '/', so is matched against the path
+    int flags;      // Flags for fnmatch()
+};
+
+/* A single line from a .gitattributes file setting the text attribute */
+struct TextRule {
+    char* pattern;
+    bool anchored;         // Pattern contained a '/', so is matched against
+                           // the path
+    int flags;             // Flags for fnmatch()
+    enum WalkText text;
+};
+
+/* A directory currently being read */
+struct WalkLevel {
+    DIR* dir;
+    size_t path_len;           // Length of the directory's path
+    struct IgnoreRule* rules;  // Rules from the directory's .gitignore
+    size_t num_rules;
+    struct TextRule* text_rules;  // Rules from the directory's .gitattributes
+    size_t num_text_rules;
+};
+
+struct Walk {
+    const struct WalkOptions* options;
+    char* path;                // Path of the current entry
+    size_t path_capacity;
+    struct WalkLevel* levels;  // Stack of directories being read
+    size_t num_levels;
+    size_t levels_capacity;
+    int root_error;            // Error opening the root directory
+};
+
+static void set_path_len(struct Walk* walk, size_t len) {
+    if(len + 1 > walk->path_capacity) {
+        walk->path_capacity = (len + 1) * 2;
+        walk->path = realloc(walk->path, walk->path_capacity);
+    }
+    walk->path[len] = '\0';
+}
+
+/* Sets 'anchored' if 'pattern' is matched against the path relative to the
+directory it applies to rather than a name, and 'flags' to the flags to match
+it with. Returns the pattern to match, without any leading '/'. */
+static char* parse_pattern(char* pattern, bool* anchored, int* flags) {
+    *anchored = false;
+    *flags = FNM_PATHNAME;
+    if(pattern[0] == '/') {
+        *anchored = true;
+        ++pattern;
+    } else if(strchr(pattern, '/') != NULL) {
+        *anchored = true;
+    }
+    if(strstr(pattern, "**") != NULL) {
+        *flags = 0;
+    }
+    return pattern;
+}
+
+/* Parses the .gitignore file in the directory 'dir_fd' into 'level'. */
+static void load_gitignore(struct WalkLevel* level, int dir_fd) {
+    int fd = openat(dir_fd, ".gitignore", O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        return;
+    }
+    FILE* file = fdopen(fd, "r");
+    if(file == NULL) {
+        close(fd);
+        return;
+    }
+    size_t rules_capacity = 0;
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_len;
+    while((line_len = getline(&line, &line_capacity, file)) != -1) {
+        // Strip the newline and unescaped trailing spaces
+        while(line_len > 0 && (line[line_len - 1] == '\n' ||
+                line[line_len - 1] == '\r' || (line[line_len - 1] == ' ' &&
+                (line_len < 2 || line[line_len - 2] != '\\')))) {
+            line[--line_len] = '\0';
+        }
+        if(line_len == 0 || line[0] == '#') {
+            continue;
+        }
+        struct IgnoreRule rule = {
+            .negate = false,
+            .dir_only = false
+        };
+        char* pattern = line;
+        if(pattern[0] == '!') {
+            rule.negate = true;
+            ++pattern;
+            --line_len;
+        }
+        if(line_len > 0 && pattern[line_len - 1] == '/') {
+            rule.dir_only = true;
+            pattern[--line_len] = '\0';
+        }
+        pattern = parse_pattern(pattern, &rule.anchored, &rule.flags);
+        if(pattern[0] == '\0') {
+            continue;
+        }
+        if(level->num_rules == rules_capacity) {
+            rules_capacity = rules_capacity ? rules_capacity * 2 : 8;
+            level->rules = realloc(
+                level->rules, rules_capacity * sizeof(struct IgnoreRule)
+            );
+        }
+        rule.pattern = strdup(pattern);
+        level->rules[level->num_rules++] = rule;
+    }
+    free(line);
+    fclose(file);
+}
+
+/* Parses the lines of the .gitattributes file in the directory 'dir_fd' which
+set the text attribute into 'level'. */
+static void load_gitattributes(struct WalkLevel* level, int dir_fd) {
+    int fd = openat(dir_fd, ".gitattributes", O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        return;
+    }
+    FILE* file = fdopen(fd, "r");
+    if(file == NULL) {
+        close(fd);
+        return;
+    }
+    size_t rules_capacity = 0;
+    char* line = NULL;
+    size_t line_capacity = 0;
+    while(getline(&line, &line_capacity, file) != -1) {
+        // Quoted patterns and macro definitions aren't supported
+        const char* separators = " \t\r\n";
+        char* save;
+        char* pattern = strtok_r(line, separators, &save);
+        if(pattern == NULL || pattern[0] == '#' || pattern[0] == '"' ||
+                pattern[0] == '[') {
+            continue;
+        }
+        // The last attribute on the line affecting text wins
+        bool found = false;
+        struct TextRule rule;
+        char* attr;
+        while((attr = strtok_r(NULL, separators, &save)) != NULL) {
+            if(!strcmp(attr, "binary") || !strcmp(attr, "-text")) {
+                rule.text = WALK_BINARY;
+            } else if(!strcmp(attr, "!text") ||
+                    !strcmp(attr, "text=auto")) {
+                rule.text = WALK_TEXT_AUTO;
+            } else if(!strcmp(attr, "text") || !strncmp(attr, "text=", 5)) {
+                rule.text = WALK_TEXT;
+            } else {
+                continue;
+            }
+            found = true;
+        }
+        pattern = parse_pattern(pattern, &rule.anchored, &rule.flags);
+        if(!found || pattern[0] == '\0') {
+            continue;
+        }
+        if(level->num_text_rules == rules_capacity) {
+            rules_capacity = rules_capacity ? rules_capacity * 2 : 8;
+            level->text_rules = realloc(
+                level->text_rules, rules_capacity * sizeof(struct TextRule)
+            );
+        }
+        rule.pattern = strdup(pattern);
+        level->text_rules[level->num_text_rules++] = rule;
+    }
+    free(line);
+    fclose(file);
+}
+
+/* Pushes the directory open as 'fd' onto the stack, taking ownership of
+'fd'. The directory's path must be in 'walk->path'. */
+static bool push_level(struct Walk* walk, int fd) {
+    DIR* dir = fdopendir(fd);
+    if(dir == NULL) {
+        close(fd);
+        return false;
+    }
+    if(walk->num_levels == walk->levels_capacity) {
+        walk->levels_capacity = walk->levels_capacity ?
+            walk->levels_capacity * 2 : 16;
+        walk->levels = realloc(
+            walk->levels, walk->levels_capacity * sizeof(struct WalkLevel)
+        );
+    }
+    struct WalkLevel* level = &walk->levels[walk->num_levels++];
+    *level = (struct WalkLevel){
+        .dir = dir,
+        .path_len = strlen(walk->path),
+        .rules = NULL,
+        .num_rules = 0,
+        .text_rules = NULL,
+        .num_text_rules = 0
+    };
+    if(walk->options->gitignore) {
+        load_gitignore(level, fd);
+    }
+    if(walk->options->gitattributes) {
+        load_gitattributes(level, fd);
+    }
+    return true;
+}
+
+static void pop_level(struct Walk* walk) {
+    struct WalkLevel* level = &walk->levels[--walk->num_levels];
+    closedir(level->dir);
+    for(size_t i = 0; i < level->num_rules; ++i) {
+        free(level->rules[i].pattern);
+    }
+    free(level->rules);
+    for(size_t i = 0; i < level->num_text_rules; ++i) {
+        free(level->text_rules[i].pattern);
+    }
+    free(level->text_rules);
+}
+
+/* Returns true if the entry 'name' at 'walk->path' is ignored by the
+.gitignore files of the directories being read. Deeper files take precedence,
+as do later patterns within a file. */
+static bool is_ignored(const struct Walk* walk, const char* name,
+                       bool is_dir) {
+    for(size_t i = walk->num_levels; i-- > 0;) {
+        const struct WalkLevel* level = &walk->levels[i];
+        const char* rel_path = walk->path + level->path_len + 1;
+        for(size_t j = level->num_rules; j-- > 0;) {
+            const struct IgnoreRule* rule = &level->rules[j];
+            if(rule->dir_only && !is_dir) {
+                continue;
+            }
+            if(!fnmatch(rule->pattern, rule->anchored ? rel_path : name,
+                        rule->flags)) {
+                return !rule->negate;
+            }
+        }
+    }
+    return false;
+}
+
+/* Returns the text attribute given to the file 'name' at 'walk->path' by the
+.gitattributes files of the directories being read */
+static enum WalkText text_attribute(const struct Walk* walk,
+                                    const char* name) {
+    for(size_t i = walk->num_levels; i-- > 0;) {
+        const struct WalkLevel* level = &walk->levels[i];
+        const char* rel_path = walk->path + level->path_len + 1;
+        for(size_t j = level->num_text_rules; j-- > 0;) {
+            const struct TextRule* rule = &level->text_rules[j];
+            if(!fnmatch(rule->pattern, rule->anchored ? rel_path : name,
+                        rule->flags)) {
+                return rule->text;
+            }
+        }
+    }
+    return WALK_TEXT_AUTO;
+}
+
+static bool matches_any(const char* name, const char* const* patterns,
+                        size_t num_patterns) {
+    for(size_t i = 0; i < num_patterns; ++i) {
+        if(!fnmatch(patterns[i], name, 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct Walk* walk_open(const char* path, const struct WalkOptions* options) {
+    struct Walk* walk = malloc(sizeof(struct Walk));
+    *walk = (struct Walk){
+        .options = options,
+        .path = NULL,
+        .path_capacity = 0,
+        .levels = NULL,
+        .num_levels = 0,
+        .levels_capacity = 0,
+        .root_error = 0
+    };
+    // Remove trailing slashes to avoid doubling them up in paths
+    size_t path_len = strlen(path);
+    while(path_len > 1 && path[path_len - 1] == '/') {
+        --path_len;
+    }
+    set_path_len(walk, path_len);
+    memcpy(walk->path, path, path_len);
+
+    int fd = open(walk->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd == -1 || !push_level(walk, fd)) {
+        walk->root_error = errno;
+    }
+    return walk;
+}
+
+char* walk_next(struct Walk* walk, int* error, enum WalkText* text) {
+    *error = 0;
+    *text = WALK_TEXT_AUTO;
+    if(walk->root_error) {
+        *error = walk->root_error;
+        walk->root_error = 0;
+        return strdup(walk->path);
+    }
+    while(walk->num_levels > 0) {
+        struct WalkLevel* level = &walk->levels[walk->num_levels - 1];
+        struct dirent* entry = readdir(level->dir);
+        if(entry == NULL) {
+            pop_level(walk);
+            continue;
+        }
+        const char* name = entry->d_name;
+        if(!strcmp(name, ".") || !strcmp(name, "..")) {
+            continue;
+        }
+
+        // Build the entry's path
+        size_t name_len = strlen(name);
+        size_t path_len = level->path_len;
+        if(walk->path[path_len - 1] != '/') {
+            set_path_len(walk, path_len + 1);
+            walk->path[path_len++] = '/';
+        }
+        set_path_len(walk, path_len + name_len);
+        memcpy(walk->path + path_len, name, name_len);
+
+        unsigned char type = entry->d_type;
+        if(type == DT_UNKNOWN) {
+            struct stat entry_stat;
+            if(fstatat(dirfd(level->dir), name, &entry_stat,
+                       AT_SYMLINK_NOFOLLOW)) {
+                continue;
+            }
+            type = S_ISDIR(entry_stat.st_mode) ? DT_DIR :
+                S_ISREG(entry_stat.st_mode) ? DT_REG : DT_LNK;
+        }
+
+        if(type == DT_DIR) {
+            if(!strcmp(name, ".git") ||
+                    matches_any(name, walk->options->excludes,
+                                walk->options->num_excludes) ||
+                    is_ignored(walk, name, true)) {
+                continue;
+            }
+            int fd = openat(
+                dirfd(level->dir), name,
+                O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC
+            );
+            if(fd == -1 || !push_level(walk, fd)) {
+                *error = errno;
+                return strdup(walk->path);
+            }
+        } else if(type == DT_REG) {
+            if(matches_any(name, walk->options->excludes,
+                           walk->options->num_excludes) ||
+                    (walk->options->num_includes > 0 &&
+                    !matches_any(name, walk->options->includes,
+                                 walk->options->num_includes)) ||
+                    is_ignored(walk, name, false)) {
+                continue;
+            }
+            *text = text_attribute(walk, name);
+            return strdup(walk->path);
+        }
+    }
+    return NULL;
+}
+
+void walk_close(struct Walk* walk) {
+    while(walk->num_levels > 0) {
+        pop_level(walk);
+    }
+    free(walk->levels);
+    free(walk->path);
+    free(walk);
+}
@@ -0,0 +1,56 @@
+#ifndef NEWLINE_WALK_H
+#define NEWLINE_WALK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Whether a file is text, according to the 'text' and 'binary' attributes
+given to it by .gitattributes files */
+enum WalkText {
+    WALK_TEXT_AUTO,  // Unspecified or 'text=auto', so decided by its contents
+    WALK_TEXT,       // 'text', or 'text' set to anything but 'auto'
+    WALK_BINARY      // '-text' or 'binary'
+};
+
+/* Decides which files are found by a walk */
+struct WalkOptions {
+    const char* const* includes;  // If any, file names must match one of these
+    size_t num_includes;
+    const char* const* excludes;  // File and directory names to skip
+    size_t num_excludes;
+    bool gitignore;               // Skip files ignored by .gitignore files
+    bool gitattributes;           // Read text attributes from .gitattributes
+};
+
+struct Walk;
+
+/* Starts walking the directory 'path' recursively. Directories are opened
+relative to their parent with openat(), and only one directory per level is
+held open at a time. Files are found as the walk goes, rather than all at
+once. */
+struct Walk* walk_open(const char* path, const struct WalkOptions* options);
+
+/* Returns the path of the next regular file found by the walk, which the
+caller must free, or NULL once the walk is complete. If a directory can't be
+opened, its path is returned instead and 'error' is set to the value of errno,
+otherwise 'error' is set to 0. 'text' is set to the file's text attribute.
+
+Symbolic links and '.git' directories are skipped. Glob patterns in
+'includes' and 'excludes' are matched against file names with fnmatch(). If
+'gitignore' is set, patterns in each .gitignore file found are applied to its
+directory and subdirectories, including negated ('!'), anchored ('/') and
+directory-only (trailing '/') patterns. Patterns containing '**' are matched
+with '*' able to match '/'.
+
+If 'gitattributes' is set, the 'text' and 'binary' attributes in each
+.gitattributes file found are applied to files in its directory and
+subdirectories the same way, except that no patterns are negated or
+directory-only. Deeper files take precedence, as do later lines within a file.
+Files with no text attribute are WALK_TEXT_AUTO. */
+char* walk_next(struct Walk* walk, int* error, enum WalkText* text);
+
+/* Closes any directories still open and releases memory allocated by
+walk_open. */
+void walk_close(struct Walk* walk);
+
+#endif // NEWLINE_WALK_H